@@ -0,0 +1,220 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "t3widget/asyncfind.h"
+#include "t3widget/findcontext.h"
+#include "t3widget/key.h"
+#include "t3widget/linestore.h"
+#include "t3widget/main.h"
+#include "t3widget/signals.h"
+#include "t3widget/textbuffer.h"
+#include "t3widget/textbuffer_impl.h"
+#include "t3widget/util.h"
+
+namespace t3widget {
+
+/* Number of lines handed to a worker at a time. */
+static const size_t block_size = 2048;
+/* Upper limit on the number of worker threads. */
+static const unsigned max_workers = 8;
+
+namespace {
+
+/* State of a single search, shared between the main thread and the workers. Lines are
+   numbered by their position in the search order: ordinal 0 is the line the search starts
+   in, the following ordinals are the lines after (or before, for backward searches) it. */
+struct search_t {
+  /* Copy of the text as it was when the search was started. */
+  std::shared_ptr<const line_store_t::snapshot_t> lines;
+
+  text_pos_t line_count;
+  text_coordinate_t from;
+  bool backward;
+  size_t ordinals;
+
+  std::atomic<size_t> next_block;
+  /* Lowest ordinal for which a match was found so far. */
+  std::atomic<size_t> best_ordinal;
+  std::atomic<bool> cancelled;
+  std::atomic<unsigned> running_workers;
+
+  std::mutex result_lock;
+  find_result_t result;
+
+  search_t() : next_block(0), best_ordinal(std::numeric_limits<size_t>::max()), cancelled(false) {}
+
+  text_pos_t line_for_ordinal(size_t ordinal) const {
+    text_pos_t line = backward ? from.line - static_cast<text_pos_t>(ordinal)
+                               : from.line + static_cast<text_pos_t>(ordinal);
+    return ((line % line_count) + line_count) % line_count;
+  }
+
+  void run_worker(std::unique_ptr<finder_t> finder) { work(finder.get()); }
+
+  void work(finder_t *finder) {
+    std::string line;
+    find_result_t line_result;
+
+    while (!cancelled) {
+      size_t first = next_block++ * block_size;
+      if (first >= ordinals || first > best_ordinal) {
+        break;
+      }
+      size_t last = std::min(first + block_size, ordinals);
+      for (size_t ordinal = first; ordinal < last && ordinal < best_ordinal && !cancelled;
+           ++ordinal) {
+        text_pos_t line_nr = line_for_ordinal(ordinal);
+        lines->get_line(line_nr, &line);
+
+        line_result.start.pos = -1;
+        line_result.end.pos = -1;
+        if (ordinal == 0) {
+          if (backward) {
+            line_result.end.pos = from.pos;
+          } else {
+            line_result.start.pos = from.pos;
+          }
+        }
+
+        if (finder->match(line, &line_result, backward)) {
+          line_result.start.line = line_result.end.line = line_nr;
+          std::unique_lock<std::mutex> l(result_lock);
+          if (ordinal < best_ordinal) {
+            best_ordinal = ordinal;
+            result = line_result;
+          }
+          break;
+        }
+      }
+    }
+
+    if (--running_workers == 0) {
+      signal_update();
+    }
+  }
+};
+
+}  // namespace
+
+struct async_find_t::implementation_t {
+  std::unique_ptr<search_t> search;
+  std::vector<std::thread> workers;
+  callback_t callback;
+  connection_t update_connection;
+  /* The snapshot used by the previous search, and the text_buffer_t::implementation_t::version of
+     the text it was taken from. Restarting a search on unchanged text, for example while the
+     needle is being typed, reuses it instead of copying the text again. */
+  std::shared_ptr<const line_store_t::snapshot_t> snapshot;
+  uint64_t snapshot_version = 0;
+
+  void stop_workers() {
+    if (search != nullptr) {
+      search->cancelled = true;
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    workers.clear();
+    search.reset();
+  }
+
+  void check_done() {
+    if (search == nullptr || search->running_workers != 0) {
+      return;
+    }
+    bool found = search->best_ordinal != std::numeric_limits<size_t>::max();
+    find_result_t result = search->result;
+    callback_t done_callback = std::move(callback);
+    stop_workers();
+    done_callback(found, result);
+  }
+};
+
+async_find_t::async_find_t() : impl(new implementation_t()) {
+  impl->update_connection =
+      connect_update_notification(bind_front(&implementation_t::check_done, impl.get()));
+}
+
+async_find_t::~async_find_t() {
+  impl->update_connection.disconnect();
+  impl->stop_workers();
+}
+
+void async_find_t::start(const text_buffer_t &text, finder_t *finder, text_coordinate_t from,
+                         bool reverse, callback_t callback) {
+  impl->stop_workers();
+
+  std::unique_ptr<search_t> search = t3widget::make_unique<search_t>();
+  if (impl->snapshot == nullptr || impl->snapshot_version != text.impl->version) {
+    /* Taking the snapshot only copies the lines that were loaded, and does not load the others. */
+    impl->snapshot = text.impl->lines.snapshot();
+    impl->snapshot_version = text.impl->version;
+  }
+  search->lines = impl->snapshot;
+  search->line_count = search->lines->size();
+  search->from = from;
+  search->backward = ((finder->get_flags() & find_flags_t::BACKWARD) != 0) ^ reverse;
+
+  /* Apart from the starting line, the lines up to the end (start) of the text are searched.
+     When wrapping, the rest of the text is searched as well, ending with the full starting
+     line. */
+  if (finder->get_flags() & find_flags_t::WRAP) {
+    search->ordinals = search->line_count + 1;
+  } else {
+    search->ordinals = search->backward ? from.line + 1 : search->line_count - from.line;
+  }
+
+  impl->callback = std::move(callback);
+  impl->search = std::move(search);
+
+  std::unique_ptr<finder_t> first_clone = finder->clone();
+  if (first_clone == nullptr) {
+    /* The finder can not be used from other threads, so search in this thread instead. The
+       result is still reported from the main loop, as for a search in the background. */
+    impl->search->running_workers = 1;
+    impl->search->work(finder);
+    return;
+  }
+
+  unsigned worker_count = std::thread::hardware_concurrency();
+  worker_count = std::max(1u, std::min(worker_count, max_workers));
+  worker_count =
+      std::min<size_t>(worker_count, (impl->search->ordinals + block_size - 1) / block_size);
+  impl->search->running_workers = worker_count;
+
+  for (unsigned i = 0; i < worker_count; ++i) {
+    impl->workers.emplace_back(&search_t::run_worker, impl->search.get(),
+                               i == 0 ? std::move(first_clone) : finder->clone());
+  }
+}
+
+void async_find_t::cancel() {
+  impl->stop_workers();
+  impl->callback = nullptr;
+}
+
+bool async_find_t::is_running() const { return impl->search != nullptr; }
+
+}  // namespace t3widget
@@ -0,0 +1,75 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_ASYNCFIND_H
+#define T3_WIDGET_ASYNCFIND_H
+
+#include <functional>
+#include <t3widget/findcontext.h>
+#include <t3widget/textbuffer.h>
+#include <t3widget/util.h>
+#include <t3widget/widget_api.h>
+
+namespace t3widget {
+
+/** Class for searching a text_buffer_t in background threads.
+
+    The search is split over a number of worker threads, each using its own clone of the
+    finder_t. If the finder_t can not be cloned, the search is performed by #start instead. The
+    result is the same as that of text_buffer_t::find: the first match in the search direction,
+    taking the find_flags_t::BACKWARD and find_flags_t::WRAP flags into account. Only one search
+    can be active at a time; starting a new search cancels the previous one.
+
+    The result is reported by calling the callback from the thread running the #main_loop
+    function, by means of the #signal_update mechanism. Because the workers operate on a snapshot
+    of the text, the text_buffer_t may be changed while the search is running. The reported
+    result refers to the text as it was when the search was started. Taking the snapshot copies
+    the lines that are held in memory, but not the parts of a file loaded by
+    text_buffer_t::load_file that were not accessed yet. The snapshot is kept, and reused by the
+    next search as long as the text_buffer_t has not changed.
+*/
+class T3_WIDGET_API async_find_t {
+ private:
+  struct T3_WIDGET_LOCAL implementation_t;
+  pimpl_t<implementation_t> impl;
+
+ public:
+  /** Type of the callback called when the search completes.
+      The first argument indicates whether a match was found. If so, the second argument holds
+      the location of the match. */
+  typedef std::function<void(bool, const find_result_t &)> callback_t;
+
+  async_find_t();
+  /** Destroy the async_find_t, cancelling any running search. */
+  ~async_find_t();
+
+  /** Start a search.
+      @param text The text_buffer_t to search.
+      @param finder The finder_t to use. A clone is made for every worker thread, so @p finder
+          does not have to remain valid. It is only used directly if finder_t::clone returns
+          @c nullptr.
+      @param from The position to start searching from. For forward searches, matches start at or
+          after this position. For backward searches, matches end at or before this position.
+      @param reverse Reverse the direction indicated by the flags of @p finder.
+      @param callback The function to call when the search completes.
+  */
+  void start(const text_buffer_t &text, finder_t *finder, text_coordinate_t from, bool reverse,
+             callback_t callback);
+  /** Cancel the running search, if any. The callback will not be called for a cancelled search. */
+  void cancel();
+  /** Returns whether a search is in progress. */
+  bool is_running() const;
+};
+
+}  // namespace t3widget
+#endif
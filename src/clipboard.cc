@@ -26,6 +26,7 @@ using lt_dlhandle = void *;
 #endif
 #endif
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
@@ -48,6 +49,46 @@ static void init_external_clipboard(bool init);
 
 static extclipboard_interface_t *extclipboard_calls;
 static connection_t init_connected = connect_on_init(init_external_clipboard);
+static connection_t update_connection;
+
+/* Provider of the primary selection, if its text has not been produced yet. */
+static std::shared_ptr<selection_provider_t> primary_provider;
+/* Set when the external clipboard needs the text of the primary selection. */
+static std::atomic<bool> primary_requested(false);
+
+selection_provider_t::~selection_provider_t() {}
+
+/** Produce the text of the primary selection, if it was set through a provider.
+    The clipboard must be locked when calling this function. */
+static void materialize_primary() {
+  if (primary_provider == nullptr) {
+    return;
+  }
+
+  std::unique_ptr<std::string> str = primary_provider->get_text();
+  primary_provider.reset();
+  if (str != nullptr && str->size() == 0) {
+    str.reset();
+  }
+
+  if (extclipboard_calls != nullptr) {
+    extclipboard_calls->provide_primary(std::move(str));
+    return;
+  }
+  primary_data.reset(str.release());
+}
+
+static void handle_update_notification() {
+  if (primary_requested.exchange(false)) {
+    ensure_clipboard_lock_t lock;
+    materialize_primary();
+  }
+}
+
+void request_primary_data() {
+  primary_requested = true;
+  signal_update();
+}
 
 /** Get the clipboard data.
 
@@ -67,6 +108,7 @@ std::shared_ptr<std::string> get_clipboard() {
     See lock_clipboard for details.
 */
 std::shared_ptr<std::string> get_primary() {
+  materialize_primary();
   if (extclipboard_calls != nullptr) {
     return extclipboard_calls->get_selection(false);
   }
@@ -86,6 +128,7 @@ void set_clipboard(std::unique_ptr<std::string> str) {
 }
 
 void set_primary(std::unique_ptr<std::string> str) {
+  primary_provider.reset();
   if (str != nullptr && str->size() == 0) {
     str.reset();
   }
@@ -99,6 +142,23 @@ void set_primary(std::unique_ptr<std::string> str) {
   primary_data.reset(str.release());
 }
 
+void set_primary_provider(std::shared_ptr<selection_provider_t> provider) {
+  if (provider == nullptr) {
+    set_primary(nullptr);
+    return;
+  }
+
+  if (extclipboard_calls != nullptr) {
+    if (!disable_primary_selection) {
+      primary_provider = std::move(provider);
+      extclipboard_calls->claim_primary_lazy();
+    }
+    return;
+  }
+  primary_provider = std::move(provider);
+  primary_data.reset();
+}
+
 static void init_external_clipboard(bool init) {
 #ifdef WITH_X11
   static lt_dlhandle extclipboard_mod;
@@ -108,6 +168,7 @@ static void init_external_clipboard(bool init) {
   }
 
   if (init) {
+    update_connection = connect_update_notification(handle_update_notification);
 #ifdef WITH_X11
     if (lt_dlinit() != 0) {
       return;
@@ -138,6 +199,8 @@ static void init_external_clipboard(bool init) {
     }
 #endif
   } else {
+    update_connection.disconnect();
+    primary_provider.reset();
 #ifdef WITH_X11
     if (extclipboard_calls != nullptr) {
       extclipboard_calls->stop();
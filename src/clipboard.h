@@ -21,11 +21,29 @@
 
 namespace t3widget {
 
+/** Interface for selection contents that are only produced when they are actually needed.
+
+    Producing the text of a large selection can be expensive. Using set_primary_provider, the
+    owner of the selection can postpone this until some program, either this program or another
+    X11 client, requests the selection. All calls are made from the thread running the main loop.
+*/
+class T3_WIDGET_API selection_provider_t {
+ public:
+  virtual ~selection_provider_t();
+  /** Produce the contents of the selection. This function is called at most once. */
+  virtual std::unique_ptr<std::string> get_text() = 0;
+};
+
 T3_WIDGET_API std::shared_ptr<std::string> get_clipboard();
 T3_WIDGET_API std::shared_ptr<std::string> get_primary();
 
 T3_WIDGET_API void set_clipboard(std::unique_ptr<std::string> str);
 T3_WIDGET_API void set_primary(std::unique_ptr<std::string> str);
+/** Set the primary selection to the text produced by @p provider.
+    The text is only produced when the primary selection is requested. The provider must
+    therefore ensure that it can still produce the text at that time, for example by taking a
+    copy of the text before it changes. */
+T3_WIDGET_API void set_primary_provider(std::shared_ptr<selection_provider_t> provider);
 T3_WIDGET_API void release_selections();
 T3_WIDGET_API void lock_clipboard();
 T3_WIDGET_API void unlock_clipboard();
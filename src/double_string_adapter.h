@@ -76,6 +76,29 @@ class double_string_adapter_t {
   size_t first_start_;
 };
 
+/* Read-only counterpart of double_string_adapter_t. */
+class double_string_view_t {
+ public:
+  double_string_view_t(string_view str) : str_(str) {
+    if (str_.empty()) {
+      first_size_ = 0;
+      first_start_ = 0;
+    } else {
+      size_t utf8_size = str_.size();
+      first_size_ = t3_utf8_get(str_.data(), &utf8_size);
+      first_start_ = utf8_size;
+    }
+  }
+
+  string_view first() const { return str_.substr(first_start_, first_size_); }
+  string_view second() const { return str_.substr(first_start_ + first_size_); }
+
+ private:
+  string_view str_;
+  size_t first_size_;
+  size_t first_start_;
+};
+
 }  // namespace t3widget
 
 #endif  // T3_WIDGET_DOUBLE_STRING_ADAPTER_H
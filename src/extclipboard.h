@@ -30,7 +30,12 @@ namespace t3widget {
 T3_WIDGET_API extern std::shared_ptr<std::string> clipboard_data;
 T3_WIDGET_API extern std::shared_ptr<std::string> primary_data;
 
-#define EXTCLIPBOARD_VERSION 1
+/* Request the data for a primary selection claimed through claim_primary_lazy. May be called
+   from any thread. The data is provided by calling provide_primary from the thread running the
+   main loop. */
+T3_WIDGET_API void request_primary_data();
+
+#define EXTCLIPBOARD_VERSION 2
 
 struct extclipboard_interface_t {
   int version;
@@ -41,6 +46,10 @@ struct extclipboard_interface_t {
   void (*lock)();
   void (*unlock)();
   void (*stop)();
+  /* Claim the primary selection, without providing the data yet. */
+  void (*claim_primary_lazy)();
+  /* Provide the data for the primary selection. The clipboard must be locked. */
+  void (*provide_primary)(std::unique_ptr<std::string> data);
 };
 
 }  // namespace t3widget
@@ -14,6 +14,7 @@
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <memory>
@@ -24,11 +25,11 @@
 #endif
 #include <string>
 #include <unicase.h>
+#include <vector>
 
 #include "t3widget/findcontext.h"
 #include "t3widget/internal.h"
 #include "t3widget/string_view.h"
-#include "t3widget/stringmatcher.h"
 #include "t3widget/util.h"
 #include "widget_api.h"
 
@@ -41,11 +42,15 @@ class T3_WIDGET_LOCAL finder_base_t : public finder_t {
      description of the error. */
   virtual bool set_needle(const std::string &needle, std::string *error_message) = 0;
 
+  std::unique_ptr<finder_t> clone() const override;
+
  protected:
   /** Create a new empty finder_t. */
-  finder_base_t(int flags, const std::string *replacement) : flags_(flags) {
+  finder_base_t(int flags, const std::string *replacement)
+      : flags_(flags), original_flags_(flags) {
     if (replacement) {
       replacement_.reset(new std::string(*replacement));
+      original_replacement_.reset(new std::string(*replacement));
     }
   }
 
@@ -55,8 +60,15 @@ class T3_WIDGET_LOCAL finder_base_t : public finder_t {
   /** Replacement string. */
   std::unique_ptr<std::string> replacement_;
 
+  /** The needle as passed to #set_needle, used by #clone. */
+  std::string original_needle_;
+
  private:
   int get_flags() const override { return flags_; }
+
+  /** The flags and replacement string as passed to the constructor, used by #clone. */
+  int original_flags_;
+  std::unique_ptr<std::string> original_replacement_;
 };
 
 class T3_WIDGET_LOCAL plain_finder_t : public finder_base_t {
@@ -74,15 +86,39 @@ class T3_WIDGET_LOCAL plain_finder_t : public finder_base_t {
   std::string get_replacement(const std::string &haystack) const override;
 
  private:
-  /** Pointer to a string_matcher_t, if a non-regex search was requested. */
-  std::unique_ptr<string_matcher_t> matcher;
-
+  /** The needle after processing escapes, and case folding for case-insensitive searches. */
+  std::string needle_;
+
+  /** The haystack most recently case folded by #fold_line. */
+  std::string folded_source_;
+  /** The address of the data of the haystack most recently case folded by #fold_line. */
+  const char *folded_source_data_;
+  /** The case-folded version of #folded_source_. */
+  std::string folded_line_;
+  /** Byte offsets of the characters in #folded_source_ and their case-folded versions in
+      #folded_line_, including the end of the strings. Both are empty if the offsets are the same
+      in both strings. */
+  std::vector<text_pos_t> source_offsets_, folded_offsets_;
   /** Space to store the case-folded representation of a single character. Allocation is handled by
       the unistring library, hence we can not use string or vector. */
   std::unique_ptr<char, free_deleter> folded_;
   /** Size of the full_finder_t::folded buffer. */
   size_t folded_size_;
 
+  /** Find the first (or last if @p reverse is @c true) occurrence of #needle_ in @p data,
+      completely within [@p start, @p end). Returns -1 if there is no such occurrence. */
+  text_pos_t find_needle(const char *data, text_pos_t start, text_pos_t end, bool reverse) const;
+  /** Search for #needle_ as a plain byte sequence, completely within [@p start, @p end). */
+  bool match_bytes(const std::string &haystack, text_pos_t start, text_pos_t end,
+                   find_result_t *result, bool reverse);
+  /** Search for #needle_ in the case-folded version of @p haystack, such that the match lies
+      completely within [@p start, @p end) of @p haystack. */
+  bool match_folded(const std::string &haystack, text_pos_t start, text_pos_t end,
+                    find_result_t *result, bool reverse);
+  /** Fill #folded_line_ and the offset tables for @p haystack, unless already done. */
+  void fold_line(const std::string &haystack);
+  /** Convert a byte offset in #folded_source_ to an offset in #folded_line_. */
+  text_pos_t source_to_folded(text_pos_t pos) const;
   /** Get the next position of a UTF-8 character. */
   static text_pos_t adjust_position(const std::string &str, text_pos_t pos, int adjust);
   /** Check if the start and end of a match are on word boundaries.
@@ -105,6 +141,9 @@ class T3_WIDGET_LOCAL regex_finder_t : public finder_base_t {
 
   /** Try to find the previously set @c needle in a string. */
   bool match(const std::string &haystack, find_result_t *result, bool reverse) override;
+  window_match_t match_window(const std::string &window, size_t start, bool at_end, bool not_eol,
+                              bool not_empty_at_start, size_t *match_start,
+                              size_t *match_end) override;
   /** Retrieve the replacement string. */
   std::string get_replacement(const std::string &) const override;
 
@@ -130,10 +169,25 @@ class T3_WIDGET_LOCAL regex_finder_t : public finder_base_t {
   /** The number of sub-matches captured. */
   int captures_;
   bool found_; /**< Boolean indicating whether the regex match was successful. */
+
+  /** Whether the last match was found by #match_window. */
+  bool window_match_;
+  /** Part of the window containing all sub-matches of the last #match_window match, for use by
+      #get_replacement. The window itself is discarded by the caller. */
+  std::string window_text_;
+  /** Offset of #window_text_ in the window. */
+  size_t window_base_;
 };
 //================================= finder_t implementation ========================================
 finder_t::~finder_t() {}
 
+std::unique_ptr<finder_t> finder_t::clone() const { return nullptr; }
+
+finder_t::window_match_t finder_t::match_window(const std::string &, size_t, bool, bool, bool,
+                                                size_t *, size_t *) {
+  return window_match_t::NO_MATCH;
+}
+
 std::unique_ptr<finder_t> finder_t::create(const std::string &needle, int flags,
                                            std::string *error_message,
                                            const std::string *replacement) {
@@ -150,11 +204,20 @@ std::unique_ptr<finder_t> finder_t::create(const std::string &needle, int flags,
   return std::move(result);
 }
 
+//================================= finder_base_t implementation ===================================
+std::unique_ptr<finder_t> finder_base_t::clone() const {
+  std::string error_message;
+  /* The needle was accepted before, so creating the finder again can not fail. */
+  return finder_t::create(original_needle_, original_flags_, &error_message,
+                          original_replacement_.get());
+}
+
 //================================= plain_finder_t implementation ==================================
 plain_finder_t::plain_finder_t(int flags, const std::string *replacement)
-    : finder_base_t(flags, replacement), folded_size_(0) {}
+    : finder_base_t(flags, replacement), folded_source_data_(nullptr), folded_size_(0) {}
 
 bool plain_finder_t::set_needle(const std::string &needle, std::string *error_message) {
+  original_needle_ = needle;
   /* Create a copy of needle, for transformation purposes. */
   std::string search_for(needle);
 
@@ -171,9 +234,9 @@ bool plain_finder_t::set_needle(const std::string &needle, std::string *error_me
     folded_needle.reset(reinterpret_cast<char *>(
         u8_casefold(reinterpret_cast<const uint8_t *>(search_for.data()), search_for.size(),
                     nullptr, nullptr, nullptr, &folded_needle_size)));
-    matcher.reset(new string_matcher_t(string_view(folded_needle.get(), folded_needle_size)));
+    needle_.assign(folded_needle.get(), folded_needle_size);
   } else {
-    matcher.reset(new string_matcher_t(search_for));
+    needle_ = search_for;
   }
 
   if (replacement_ != nullptr) {
@@ -189,15 +252,10 @@ bool plain_finder_t::set_needle(const std::string &needle, std::string *error_me
 }
 
 bool plain_finder_t::match(const std::string &haystack, find_result_t *result, bool reverse) {
-  int match_result;
-
-  if (!(flags_ & find_flags_t::VALID)) {
+  if (!(flags_ & find_flags_t::VALID) || needle_.empty()) {
     return false;
   }
 
-  size_t c_size;
-  const char *c;
-
   text_pos_t start = std::max<text_pos_t>(0, result->start.pos);
   if (static_cast<size_t>(start) > haystack.size()) {
     start = static_cast<text_pos_t>(haystack.size());
@@ -205,83 +263,187 @@ bool plain_finder_t::match(const std::string &haystack, find_result_t *result, b
   text_pos_t end = result->end.pos < 0 || static_cast<size_t>(result->end.pos) > haystack.size()
                        ? static_cast<text_pos_t>(haystack.size())
                        : result->end.pos;
-  if (reverse) {
-    std::swap(start, end);
+
+  /* A valid UTF-8 needle can only match at character boundaries in valid UTF-8 text, so a simple
+     byte comparison suffices. For case-insensitive searches, the comparison is done on the
+     case-folded text. */
+  if (flags_ & find_flags_t::ICASE) {
+    return match_folded(haystack, start, end, result, reverse);
   }
-  text_pos_t curr_char = start;
+  return match_bytes(haystack, start, end, result, reverse);
+}
 
-  if (reverse) {
-    matcher->reset();
-    while (curr_char > 0) {
-      text_pos_t next_char = adjust_position(haystack, curr_char, -1);
+static inline int is_start_char(int c) { return (c & 0xc0) != 0x80; }
 
-      if (next_char < end) {
-        return false;
-      }
+text_pos_t plain_finder_t::find_needle(const char *data, text_pos_t start, text_pos_t end,
+                                       bool reverse) const {
+  const text_pos_t needle_size = needle_.size();
+  const char first = needle_.front();
+  const char last = needle_.back();
+  const text_pos_t last_start = end - needle_size;
 
-      string_view substr = string_view(haystack).substr(next_char, (curr_char - next_char));
-      if (flags_ & find_flags_t::ICASE) {
-        c_size = folded_size_;
-        char *c_data = reinterpret_cast<char *>(
-            u8_casefold(reinterpret_cast<const uint8_t *>(substr.data()), substr.size(), nullptr,
-                        nullptr, reinterpret_cast<uint8_t *>(folded_.get()), &c_size));
-        c = c_data;
-        if (c_data != folded_.get()) {
-          // Previous value of folded will be automatically deleted.
-          folded_.reset(c_data);
-          folded_size_ = c_size;
-        }
-        substr = string_view(c_data, c_size);
-      }
-      match_result = matcher->previous_char(substr);
-      if (match_result >= 0 &&
-          (!(flags_ & find_flags_t::WHOLE_WORD) ||
-           check_boundaries(haystack, next_char,
-                            adjust_position(haystack, start, -match_result)))) {
-        result->end.pos = adjust_position(haystack, start, -match_result);
-        result->start.pos = next_char;
-        return true;
+  /* Candidates are located by their first byte, and the last byte is checked before comparing
+     the whole needle, to quickly discard most false candidates. */
+  if (reverse) {
+    for (text_pos_t pos = last_start; pos >= start; pos--) {
+      if (data[pos] == first && data[pos + needle_size - 1] == last &&
+          memcmp(data + pos, needle_.data(), needle_size) == 0) {
+        return pos;
       }
-      curr_char = next_char;
     }
-    return false;
   } else {
-    matcher->reset();
-    while (static_cast<size_t>(curr_char) < haystack.size()) {
-      text_pos_t next_char = adjust_position(haystack, curr_char, 1);
+    for (text_pos_t pos = start; pos <= last_start; pos++) {
+      const char *candidate =
+          static_cast<const char *>(memchr(data + pos, first, last_start - pos + 1));
+      if (candidate == nullptr) {
+        return -1;
+      }
+      pos = candidate - data;
+      if (data[pos + needle_size - 1] == last &&
+          memcmp(candidate, needle_.data(), needle_size) == 0) {
+        return pos;
+      }
+    }
+  }
+  return -1;
+}
 
-      if (next_char > end) {
-        return false;
+bool plain_finder_t::match_bytes(const std::string &haystack, text_pos_t start, text_pos_t end,
+                                 find_result_t *result, bool reverse) {
+  const text_pos_t needle_size = needle_.size();
+  text_pos_t match_start;
+
+  while ((match_start = find_needle(haystack.data(), start, end, reverse)) >= 0) {
+    if (is_start_char(haystack[match_start]) &&
+        (!(flags_ & find_flags_t::WHOLE_WORD) ||
+         check_boundaries(haystack, match_start, match_start + needle_size))) {
+      result->start.pos = match_start;
+      result->end.pos = match_start + needle_size;
+      return true;
+    }
+    if (reverse) {
+      end = match_start + needle_size - 1;
+    } else {
+      start = match_start + 1;
+    }
+  }
+  return false;
+}
+
+bool plain_finder_t::match_folded(const std::string &haystack, text_pos_t start, text_pos_t end,
+                                  find_result_t *result, bool reverse) {
+  const text_pos_t needle_size = needle_.size();
+
+  fold_line(haystack);
+  start = source_to_folded(start);
+  end = source_to_folded(end);
+
+  text_pos_t match_start;
+  while ((match_start = find_needle(folded_line_.data(), start, end, reverse)) >= 0) {
+    text_pos_t match_end = match_start + needle_size;
+    if (reverse) {
+      end = match_end - 1;
+    } else {
+      start = match_start + 1;
+    }
+
+    /* Only matches consisting of the folded versions of complete characters count. */
+    if (!folded_offsets_.empty()) {
+      std::vector<text_pos_t>::const_iterator start_iter =
+          std::lower_bound(folded_offsets_.cbegin(), folded_offsets_.cend(), match_start);
+      std::vector<text_pos_t>::const_iterator end_iter =
+          std::lower_bound(start_iter, folded_offsets_.cend(), match_end);
+      if (*start_iter != match_start || end_iter == folded_offsets_.cend() ||
+          *end_iter != match_end) {
+        continue;
       }
+      match_start = source_offsets_[start_iter - folded_offsets_.cbegin()];
+      match_end = source_offsets_[end_iter - folded_offsets_.cbegin()];
+    } else if (!is_start_char(haystack[match_start]) ||
+               (static_cast<size_t>(match_end) < haystack.size() &&
+                !is_start_char(haystack[match_end]))) {
+      continue;
+    }
 
-      string_view substr = string_view(haystack).substr(curr_char, (next_char - curr_char));
-      if (flags_ & find_flags_t::ICASE) {
-        c_size = folded_size_;
-        char *c_data = reinterpret_cast<char *>(
-            u8_casefold(reinterpret_cast<const uint8_t *>(substr.data()), substr.size(), nullptr,
-                        nullptr, reinterpret_cast<uint8_t *>(folded_.get()), &c_size));
-        if (c_data != folded_.get()) {
-          // Previous value of folded will be automatically deleted.
-          folded_.reset(c_data);
-          folded_size_ = c_size;
-        }
-        substr = string_view(c_data, c_size);
+    if (!(flags_ & find_flags_t::WHOLE_WORD) ||
+        check_boundaries(haystack, match_start, match_end)) {
+      result->start.pos = match_start;
+      result->end.pos = match_end;
+      return true;
+    }
+  }
+  return false;
+}
+
+void plain_finder_t::fold_line(const std::string &haystack) {
+  /* Repeated searches in the same line, e.g. for find-next or replace-all, reuse the result. The
+     line is identified by the address and size of its data, which rules out other lines without
+     comparing them. The contents are still compared, as a line may have been changed in place. */
+  if (haystack.data() == folded_source_data_ && haystack.size() == folded_source_.size() &&
+      memcmp(haystack.data(), folded_source_.data(), haystack.size()) == 0) {
+    return;
+  }
+
+  folded_source_data_ = haystack.data();
+  folded_source_ = haystack;
+  folded_line_.clear();
+  folded_line_.reserve(haystack.size());
+  source_offsets_.clear();
+  folded_offsets_.clear();
+
+  for (size_t pos = 0; pos < haystack.size();) {
+    unsigned char c = haystack[pos];
+    if (c < 0x80) {
+      /* Case folding of ASCII characters only affects the upper case letters. */
+      folded_line_ += static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+      if (!folded_offsets_.empty()) {
+        source_offsets_.push_back(pos);
+        folded_offsets_.push_back(folded_line_.size() - 1);
       }
-      match_result = matcher->next_char(substr);
-      if (match_result >= 0 &&
-          (!(flags_ & find_flags_t::WHOLE_WORD) ||
-           check_boundaries(haystack, adjust_position(haystack, start, match_result), next_char))) {
-        result->start.pos = adjust_position(haystack, start, match_result);
-        result->end.pos = next_char;
-        return true;
+      pos++;
+      continue;
+    }
+
+    size_t next_pos = adjust_position(haystack, pos, 1);
+    size_t c_size = folded_size_;
+    char *c_data = reinterpret_cast<char *>(
+        u8_casefold(reinterpret_cast<const uint8_t *>(haystack.data() + pos), next_pos - pos,
+                    nullptr, nullptr, reinterpret_cast<uint8_t *>(folded_.get()), &c_size));
+    if (c_data != folded_.get()) {
+      // Previous value of folded will be automatically deleted.
+      folded_.reset(c_data);
+      folded_size_ = c_size;
+    }
+
+    if (folded_offsets_.empty() && c_size != next_pos - pos) {
+      /* The offsets start to differ, so create the offset tables for the part up to here, in
+         which all characters have the same size in both strings. */
+      for (size_t i = 0; i < pos; i = adjust_position(haystack, i, 1)) {
+        source_offsets_.push_back(i);
+        folded_offsets_.push_back(i);
       }
-      curr_char = next_char;
     }
-    return false;
+    if (!folded_offsets_.empty()) {
+      source_offsets_.push_back(pos);
+      folded_offsets_.push_back(folded_line_.size());
+    }
+    folded_line_.append(c_data, c_size);
+    pos = next_pos;
+  }
+
+  if (!folded_offsets_.empty()) {
+    source_offsets_.push_back(haystack.size());
+    folded_offsets_.push_back(folded_line_.size());
   }
 }
 
-static inline int is_start_char(int c) { return (c & 0xc0) != 0x80; }
+text_pos_t plain_finder_t::source_to_folded(text_pos_t pos) const {
+  if (folded_offsets_.empty()) {
+    return pos;
+  }
+  return folded_offsets_[std::lower_bound(source_offsets_.begin(), source_offsets_.end(), pos) -
+                         source_offsets_.begin()];
+}
 
 text_pos_t plain_finder_t::adjust_position(const std::string &str, text_pos_t pos, int adjust) {
   if (adjust > 0) {
@@ -319,13 +481,15 @@ std::string plain_finder_t::get_replacement(const std::string &) const { return
 
 //================================= regex_finder_t implementation ==================================
 regex_finder_t::regex_finder_t(int flags, const std::string *replacement)
-    : finder_base_t(flags, replacement) {}
+    : finder_base_t(flags, replacement), window_match_(false), window_base_(0) {}
 
 bool regex_finder_t::set_needle(const std::string &needle, std::string *error_message) {
   int error_code;
   PCRE2_SIZE error_offset;
   int pcre_flags = PCRE2_UTF;
 
+  original_needle_ = needle;
+
   std::string pattern = flags_ & find_flags_t::ANCHOR_WORD_LEFT ? "(?:\\b" : "(?:";
   pattern += needle;
   pattern += flags_ & find_flags_t::ANCHOR_WORD_RIGHT ? "\\b)" : ")";
@@ -333,6 +497,11 @@ bool regex_finder_t::set_needle(const std::string &needle, std::string *error_me
   if (flags_ & find_flags_t::ICASE) {
     pcre_flags |= PCRE2_CASELESS;
   }
+  /* Windows passed to match_window contain multiple lines, for which ^ and $ should still match
+     at the line boundaries. */
+  if (flags_ & find_flags_t::MULTILINE) {
+    pcre_flags |= PCRE2_MULTILINE;
+  }
 
   regex_.reset(pcre2_compile_8(reinterpret_cast<PCRE2_SPTR8>(pattern.c_str()), pattern.size(),
                                pcre_flags, &error_code, &error_offset, nullptr));
@@ -369,6 +538,7 @@ bool regex_finder_t::match(const std::string &haystack, find_result_t *result, b
 
   int pcre_flags = PCRE2_NO_UTF_CHECK;
   found_ = false;
+  window_match_ = false;
 
   PCRE2_SIZE start;
   PCRE2_SIZE end;
@@ -427,29 +597,17 @@ bool regex_finder_t::match(const std::string &haystack, find_result_t *result, b
       }
       pcre_flags |= PCRE2_NOTBOL;
     }
-  } else {
-    while (!found_ && start <= end) {
-      match_result = pcre2_match_8(regex_.get(), reinterpret_cast<PCRE2_SPTR8>(haystack.data()),
-                                   end, start, pcre_flags, match_data_.get(), nullptr);
-      captures_ = match_result;
-      if (match_result < 0) {
-        break;
-      }
-      if (may_not_match_start) {
-        may_not_match_start = false;
-        found_ = pcre2_get_ovector_pointer_8(match_data_.get())[0] != start;
-        if (!found_) {
-          PCRE2_SIZE new_start = text_line_t::adjust_position(haystack, start, 1);
-          if (new_start == start) {
-            break;
-          }
-          start = new_start;
-        }
-      } else {
-        found_ = true;
-      }
-      pcre_flags |= PCRE2_NOTBOL;
+  } else if (start <= end) {
+    /* Only an empty match is excluded at the start point. A non-empty match starting there is
+       found, as it is by plain_finder_t, such that searching from the end of a match also finds
+       a match directly following it. */
+    if (may_not_match_start) {
+      pcre_flags |= PCRE2_NOTEMPTY_ATSTART;
     }
+    match_result = pcre2_match_8(regex_.get(), reinterpret_cast<PCRE2_SPTR8>(haystack.data()),
+                                 end, start, pcre_flags, match_data_.get(), nullptr);
+    captures_ = match_result;
+    found_ = match_result >= 0;
   }
   if (!found_) {
     return false;
@@ -459,12 +617,72 @@ bool regex_finder_t::match(const std::string &haystack, find_result_t *result, b
   return true;
 }
 
+finder_t::window_match_t regex_finder_t::match_window(const std::string &window, size_t start,
+                                                      bool at_end, bool not_eol,
+                                                      bool not_empty_at_start,
+                                                      size_t *match_start, size_t *match_end) {
+  if (!(flags_ & find_flags_t::VALID)) {
+    return window_match_t::NO_MATCH;
+  }
+
+  int pcre_flags = PCRE2_NO_UTF_CHECK;
+  found_ = false;
+  window_match_ = false;
+
+  /* With PCRE2_PARTIAL_HARD, a match that reaches the end of the window is reported as partial
+     if more text could change the outcome. This is what allows the caller to search using a
+     window of limited size. */
+  if (!at_end) {
+    pcre_flags |= PCRE2_PARTIAL_HARD;
+  }
+  if (not_eol) {
+    pcre_flags |= PCRE2_NOTEOL;
+  }
+  if (not_empty_at_start) {
+    pcre_flags |= PCRE2_NOTEMPTY_ATSTART;
+  }
+
+  int match_result =
+      pcre2_match_8(regex_.get(), reinterpret_cast<PCRE2_SPTR8>(window.data()), window.size(),
+                    start, pcre_flags, match_data_.get(), nullptr);
+  const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer_8(match_data_.get());
+  if (match_result == PCRE2_ERROR_PARTIAL) {
+    *match_start = ovector[0];
+    return window_match_t::PARTIAL;
+  } else if (match_result < 0) {
+    return window_match_t::NO_MATCH;
+  }
+
+  found_ = true;
+  window_match_ = true;
+  captures_ = match_result;
+  *match_start = ovector[0];
+  *match_end = ovector[1];
+
+  PCRE2_SIZE first = ovector[0];
+  PCRE2_SIZE last = ovector[1];
+  for (int i = 1; i < captures_; ++i) {
+    if (ovector[2 * i] != PCRE2_UNSET) {
+      first = std::min(first, ovector[2 * i]);
+      last = std::max(last, ovector[2 * i + 1]);
+    }
+  }
+  window_base_ = first;
+  window_text_.assign(window, first, last - first);
+  return window_match_t::MATCH;
+}
+
 std::string regex_finder_t::get_replacement(const std::string &haystack) const {
   std::string retval(*replacement_);
   /* Replace the following strings with the matched items:
      EDA481 - EDA489. */
   size_t pos = 0;
 
+  /* For matches found by match_window, the haystack passed by the caller is not the text the
+     offsets refer to. */
+  const std::string &text = window_match_ ? window_text_ : haystack;
+  const size_t base = window_match_ ? window_base_ : 0;
+
   const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer_8(match_data_.get());
   while ((pos = retval.find("\xed\xa4", pos)) != std::string::npos) {
     if (pos + 3 > retval.size()) {
@@ -472,8 +690,8 @@ std::string regex_finder_t::get_replacement(const std::string &haystack) const {
       break;
     }
     int capture_nr = retval[pos + 2] & 0x7f;
-    if (captures_ > capture_nr) {
-      retval.replace(pos, 3, haystack.data() + ovector[2 * capture_nr],
+    if (captures_ > capture_nr && ovector[2 * capture_nr] != PCRE2_UNSET) {
+      retval.replace(pos, 3, text.data() + ovector[2 * capture_nr] - base,
                      ovector[2 * capture_nr + 1] - ovector[2 * capture_nr]);
     } else {
       retval.erase(pos, 3);
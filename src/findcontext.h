@@ -23,8 +23,8 @@
 namespace t3widget {
 
 /** A struct holding the result of a find operation.
-    In the current situation, find operations work on a single line. Therefore
-    this struct does not contain line references.
+    Only searches using find_flags_t::MULTILINE can produce results spanning multiple lines. For
+    all other searches, the @c start and @c end members refer to the same line.
 */
 struct T3_WIDGET_API find_result_t {
   text_coordinate_t start, end;
@@ -46,10 +46,41 @@ class T3_WIDGET_API finder_t {
       negative position. Note the the line numbers are ignored.
   */
   virtual bool match(const std::string &haystack, find_result_t *result, bool reverse) = 0;
+  /** Result of #match_window. */
+  enum class window_match_t { NO_MATCH, MATCH, PARTIAL };
+
+  /** Try to find the previously set @c needle in a window of text spanning multiple lines.
+
+      This is used for find_flags_t::MULTILINE searches, where the lines of the window are joined
+      by newline characters. Only regular expression searches support this; other finder_t
+      classes never match.
+
+      @param window The text to search.
+      @param start The offset in @p window at which the match may start.
+      @param at_end Whether @p window extends to the end of the text that is searched. If not, a
+          match that may need more text than the window contains is reported as
+          window_match_t::PARTIAL, with @p match_start set to its start. The caller should then
+          retry with a window that contains more text.
+      @param not_eol Whether the end of @p window is not the end of a line.
+      @param not_empty_at_start Whether an empty match at @p start should be ignored.
+      @param match_start Location to store the offset of the start of the match.
+      @param match_end Location to store the offset of the end of the match.
+  */
+  virtual window_match_t match_window(const std::string &window, size_t start, bool at_end,
+                                      bool not_eol, bool not_empty_at_start, size_t *match_start,
+                                      size_t *match_end);
   /** Retrieve the flags set when setting the search context. */
   virtual int get_flags() const = 0;
   /** Retrieve the replacement string. */
   virtual std::string get_replacement(const std::string &haystack) const = 0;
+  /** Create a new finder_t with the same needle, flags and replacement.
+
+      The finder_t classes keep state between calls to #match, so a single instance can not be
+      used from multiple threads at the same time. The copy returned by this function is
+      independent of the original, and can be used in another thread. The default implementation
+      returns @c nullptr, indicating that the finder_t can not be cloned.
+  */
+  virtual std::unique_ptr<finder_t> clone() const;
 
   /** Creates a finder_t (or rather a subclass) with the given parameters.
       @param needle The string to search for.
@@ -19,6 +19,7 @@
 #endif
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -101,10 +102,15 @@ T3_WIDGET_LOCAL void deinit_keys();
 /** Switch back to best keypad mode after using #deinit_keys. */
 T3_WIDGET_LOCAL void reinit_keys();
 /** Insert a key to the queue, marked to ensure it is not interpreted by any widget except text
- * widgets. */
+ * widgets. Must only be called from the thread running the main loop. */
 T3_WIDGET_LOCAL void insert_protected_key(t3widget::key_t key);
 /** Read chars into buffer for processing. */
 T3_WIDGET_LOCAL bool read_keychar(int timeout);
+/** Read a key from the queue, waiting at most until @p deadline.
+    @return @c true if a key was read, @c false if the deadline passed first. */
+T3_WIDGET_LOCAL bool read_key_until(key_t *key, std::chrono::steady_clock::time_point deadline);
+/** Retrieve the text of a paste from the input queue. Must be called once for each #EKEY_PASTE. */
+T3_WIDGET_LOCAL std::string read_pasted_text();
 
 /* char_buffer for key and mouse handling. Has to be shared between key.cc and
    mouse.cc because of XTerm in-band mouse reporting. */
@@ -136,6 +142,12 @@ enum { CLASS_WHITESPACE, CLASS_ALNUM, CLASS_GRAPH, CLASS_OTHER };
 /** Get the character class associated with the character at a specific position in a string. */
 T3_WIDGET_LOCAL int get_class(const std::string &str, text_pos_t pos);
 
+/** Returns the length of the longest prefix of @p str which is valid UTF-8. */
+T3_WIDGET_LOCAL size_t valid_utf8_prefix(string_view str);
+/** Append @p str to @p result, replacing invalid UTF-8 sequences in the same way as when the text
+    of a text_line_t is set. */
+T3_WIDGET_LOCAL void append_utf8_normalized(std::string *result, string_view str);
+
 template <typename C>
 void remove_element(C &container, typename C::value_type value) {
   container.erase(std::remove(container.begin(), container.end(), value), container.end());
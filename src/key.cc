@@ -11,7 +11,9 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <cstring>
@@ -33,9 +35,11 @@
 #include <type_traits>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 #include "t3key/key_errors.h"
 #include "t3window/terminal.h"
+#include "t3window/utf8.h"
 
 namespace t3widget {
 
@@ -93,7 +97,108 @@ static const kp_mapping_t kp_mappings[] = {
     {EKEY_KP_NL, EKEY_NL},     {EKEY_KP_DIV, '/'},          {EKEY_KP_MUL, '*'},
     {EKEY_KP_PLUS, '+'},       {EKEY_KP_MINUS, '-'}};
 
-static std::map<std::string, key_t> map;
+namespace {
+
+/* Trie of the escape sequences of the known keys, excluding the leading escape character. The
+   trie is built by init_keys, after which it is only read by the thread decoding the input. The
+   nodes are stored in a single array, with the outgoing edges of each node in a contiguous range
+   of another array, sorted by byte value. Decoding a sequence therefore is a walk over the trie,
+   without allocations. */
+class sequence_trie_t {
+ public:
+  enum : uint32_t { root = 0, no_node = UINT32_MAX };
+
+  sequence_trie_t() { clear(); }
+
+  /* Build the trie from a map of escape sequences to keys. */
+  void build(const std::map<std::string, key_t> &sequences) {
+    nodes.clear();
+    edge_bytes.clear();
+    edge_nodes.clear();
+    std::vector<std::pair<string_view, key_t>> entries;
+    for (const std::pair<const std::string, key_t> &sequence : sequences) {
+      if (sequence.first.size() > 1 && sequence.first[0] == EKEY_ESC) {
+        entries.emplace_back(string_view(sequence.first).substr(1), sequence.second);
+      }
+    }
+    add_node(entries.begin(), entries.end(), 0);
+  }
+
+  void clear() {
+    nodes.assign(1, node_t{false, EKEY_IGNORE, 0, 0});
+    edge_bytes.clear();
+    edge_nodes.clear();
+  }
+
+  /* Returns the node reached from node by byte c, or no_node if none of the sequences continues
+     with c. */
+  uint32_t next(uint32_t node, unsigned char c) const {
+    const node_t &n = nodes[node];
+    const unsigned char *first = edge_bytes.data() + n.first_edge;
+    const unsigned char *last = first + n.edge_count;
+    const unsigned char *edge = std::lower_bound(first, last, c);
+    return edge != last && *edge == c ? edge_nodes[edge - edge_bytes.data()] : no_node;
+  }
+
+  /* Returns whether a sequence ends in node. If not, node is only a prefix of longer sequences. */
+  bool has_key(uint32_t node) const { return nodes[node].has_key; }
+  /* Returns the key for the sequence ending in node. This may be EKEY_IGNORE for sequences that
+     should be ignored. */
+  key_t get_key(uint32_t node) const { return nodes[node].key; }
+
+ private:
+  typedef std::vector<std::pair<string_view, key_t>>::const_iterator entry_iterator_t;
+
+  struct node_t {
+    bool has_key;
+    key_t key;
+    uint32_t first_edge, edge_count;
+  };
+
+  /* Add the node for the sequences in the range [first, last), which are sorted and share their
+     first depth bytes. Returns the index of the node. */
+  uint32_t add_node(entry_iterator_t first, entry_iterator_t last, size_t depth) {
+    uint32_t node = nodes.size();
+    nodes.push_back(node_t{false, EKEY_IGNORE, 0, 0});
+    if (first != last && first->first.size() == depth) {
+      nodes[node].has_key = true;
+      nodes[node].key = first->second;
+      ++first;
+    }
+
+    /* Reserve the edges first, such that the edges of this node are contiguous. */
+    uint32_t first_edge = edge_bytes.size();
+    for (entry_iterator_t iter = first; iter != last; ++iter) {
+      unsigned char c = iter->first[depth];
+      if (edge_bytes.size() == first_edge || edge_bytes.back() != c) {
+        edge_bytes.push_back(c);
+        edge_nodes.push_back(no_node);
+      }
+    }
+    nodes[node].first_edge = first_edge;
+    nodes[node].edge_count = edge_bytes.size() - first_edge;
+
+    for (uint32_t edge = first_edge; first != last; ++edge) {
+      entry_iterator_t group_end = first;
+      while (group_end != last && static_cast<unsigned char>(group_end->first[depth]) ==
+                                      edge_bytes[edge]) {
+        ++group_end;
+      }
+      uint32_t child = add_node(first, group_end, depth + 1);
+      edge_nodes[edge] = child;
+      first = group_end;
+    }
+    return node;
+  }
+
+  std::vector<node_t> nodes;
+  std::vector<unsigned char> edge_bytes;
+  std::vector<uint32_t> edge_nodes;
+};
+
+}  // namespace
+
+static sequence_trie_t sequences;
 static key_t map_single[128];
 
 static std::string leave, enter;
@@ -114,6 +219,9 @@ static int key_timeout = -1;
 static bool drop_single_esc = true;
 
 static bool in_bracketed_paste;
+/* Text pasted so far in the current bracketed paste, and the completed pastes. */
+static std::string paste_text;
+static paste_buffer_t paste_buffer;
 
 static key_t decode_sequence(bool outer);
 static key_t bracketed_paste_decode();
@@ -220,7 +328,7 @@ bool read_keychar(int timeout) {
               transcript_strerror(transcript_error));
     }
     lprintf("New codeset: %s\n", t3_term_get_codeset());
-    key_buffer.push_back_unique(EKEY_UPDATE_TERMINAL);
+    key_buffer.post_event(EKEY_UPDATE_TERMINAL);
   }
 
   if (c < T3_WARN_MIN) {
@@ -261,12 +369,12 @@ static void read_keys() {
           signal_pipe[0] = -1;
           return;
         case WINCH_SIGNAL:
-          key_buffer.push_back_unique(EKEY_RESIZE);
+          key_buffer.post_event(EKEY_RESIZE);
           break;
         case EXIT_MAIN_LOOP_SIGNAL: {
           unsigned char value;
           nosig_read(signal_pipe[0], reinterpret_cast<char *>(&value), 1);
-          key_buffer.push_back_unique(EKEY_EXIT_MAIN_LOOP + value);
+          key_buffer.push_back(EKEY_EXIT_MAIN_LOOP + value);
           break;
         }
         default:
@@ -313,15 +421,26 @@ static void read_keys() {
       }
       if (c >= 0) {
         if (in_bracketed_paste) {
-          // Unfortunately, (some) terminals convert \n in the input into \r when pasting. There
-          // seems to be no way to turn this off. So we'll have to pretend that any \r is the same
-          // as the user pressing the return key, even though if the actual pasted text contains
-          // \r\n as line endings this will double the number of newlines. As this is the same when
-          // not using bracketed paste, this is a acceptable strategy.
-          key_buffer.push_back(c == '\n' || c == '\r' ? EKEY_NL : EKEY_PROTECT | c);
+          /* The pasted text is collected, and delivered as a whole when the paste ends. This
+             allows the receiving widget to insert it as a single block, rather than character by
+             character. */
+          if (c == EKEY_PASTE_END) {
+            in_bracketed_paste = false;
+            paste_buffer.push_back(std::move(paste_text));
+            paste_text.clear();
+            key_buffer.push_back(EKEY_PASTE);
+          } else {
+            // Unfortunately, (some) terminals convert \n in the input into \r when pasting. There
+            // seems to be no way to turn this off. So we'll have to pretend that any \r is the
+            // same as the user pressing the return key, even though if the actual pasted text
+            // contains \r\n as line endings this will double the number of newlines. As this is
+            // the same when not using bracketed paste, this is a acceptable strategy.
+            char buffer[5];
+            paste_text.append(buffer, t3_utf8_put(c == '\r' ? '\n' : c, buffer));
+          }
         } else if (c == EKEY_PASTE_START) {
           in_bracketed_paste = true;
-          key_buffer.push_back(EKEY_PASTE_START);
+          paste_text.clear();
         } else {
           key_buffer.push_back(c);
         }
@@ -332,74 +451,90 @@ static void read_keys() {
 
 key_t read_key() { return key_buffer.pop_front(); }
 
-static void unget_key_sequence(const std::string &sequence) {
+std::string read_pasted_text() { return paste_buffer.pop_front(); }
+
+bool read_key_until(key_t *key, std::chrono::steady_clock::time_point deadline) {
+  return key_buffer.pop_front_until(key, deadline);
+}
+
+static void unget_key_sequence(string_view sequence) {
   for (char c : reverse_view(sequence)) {
     unget_keychar(c);
   }
 }
 
 static key_t decode_sequence(bool outer) {
-  std::string sequence;
+  char sequence[MAX_SEQUENCE];
+  size_t length = 0;
+  uint32_t node = sequence_trie_t::root;
   int c;
 
-  sequence.push_back(EKEY_ESC);
+  sequence[length++] = EKEY_ESC;
 
-  while (sequence.size() < MAX_SEQUENCE) {
+  while (length < MAX_SEQUENCE) {
     while ((c = get_next_keychar()) >= 0) {
       if (c == EKEY_ESC) {
-        if (sequence.size() == 1 && outer) {
+        if (length == 1 && outer) {
           key_t alted = decode_sequence(false);
           return alted >= 0 ? alted | EKEY_META : (alted == -2 ? EKEY_ESC : -1);
         }
         unget_keychar(c);
         goto unknown_sequence;
       }
+      if (length == MAX_SEQUENCE) {
+        unget_keychar(c);
+        goto unknown_sequence;
+      }
 
-      sequence.push_back(c);
+      sequence[length++] = c;
 
-      std::map<std::string, key_t>::iterator iter = map.lower_bound(sequence);
-      if (iter->first == sequence) {
-        return iter->second;
+      if (node != sequence_trie_t::no_node) {
+        node = sequences.next(node, c);
+        if (node != sequence_trie_t::no_node && sequences.has_key(node)) {
+          return sequences.get_key(node);
+        }
       }
-      bool is_prefix = starts_with(iter->first, sequence);
+      /* Nodes only exist for (prefixes of) known sequences. */
+      bool is_prefix = node != sequence_trie_t::no_node;
 
       /* Detect and ignore ANSI CSI sequences, regardless of whether they are recognised.
          An exception is made for mouse events, which also start with CSI. */
       if (sequence[1] == '[' && !is_prefix) {
-        if (sequence.size() == 3 && c == 'M' && use_xterm_mouse_reporting()) {
+        if (length == 3 && c == 'M' && use_xterm_mouse_reporting()) {
           if (!outer) {
             /* If this is not the outer decode_sequence call, push everything
                back onto the character list, and do nothing. A next call to
                decode_sequence will take care of the mouse handling. */
-            unget_key_sequence(sequence);
+            unget_key_sequence(string_view(sequence, length));
             return -1;
           }
           return decode_xterm_mouse() ? EKEY_MOUSE_EVENT : -1;
-        } else if (sequence.size() > 3 && (c == 'M' || c == 'm') && use_xterm_mouse_reporting()) {
+        } else if (length > 3 && (c == 'M' || c == 'm') && use_xterm_mouse_reporting()) {
           if (!outer) {
             /* If this is not the outer decode_sequence call, push everything
                back onto the character list, and do nothing. A next call to
                decode_sequence will take care of the mouse handling. */
-            unget_key_sequence(sequence);
+            unget_key_sequence(string_view(sequence, length));
             return -1;
           }
-          return decode_xterm_mouse_sgr_urxvt(sequence) ? EKEY_MOUSE_EVENT : -1;
+          return decode_xterm_mouse_sgr_urxvt(string_view(sequence, length)) ? EKEY_MOUSE_EVENT
+                                                                              : -1;
         } else if (c == '~') {
-          if (sequence.size() != 6 || sequence[2] != '2' || sequence[3] != '0') {
+          if (length != 6 || sequence[2] != '2' || sequence[3] != '0') {
             return -1;
           }
           if (!outer) {
             /* If this is not the outer decode_sequence call, push everything
                back onto the character list, and do nothing. A next call to
                decode_sequence will take care of the paste handling. */
-            unget_key_sequence(sequence);
+            unget_key_sequence(string_view(sequence, length));
             return -1;
           }
           if (sequence[4] == '0') {
             return EKEY_PASTE_START;
           }
           return -1;
-        } else if (sequence.size() > 2 && c >= 0x40 && c < 0x7f) {
+        } else if (length > 2 && c >= 0x40 && c < 0x7f) {
           return -1;
         } else if (c < 0x20 || c > 0x7f) {
           /* Drop unknown leading sequence if some non-CSI byte is found. */
@@ -420,7 +555,7 @@ static key_t decode_sequence(bool outer) {
   }
 
 unknown_sequence:
-  if (sequence.size() == 2) {
+  if (length == 2) {
     key_t alted_key;
     unget_keychar(sequence[1]);
     /* It is quite possible that we only read a partial character here. So if we haven't
@@ -438,7 +573,7 @@ unknown_sequence:
       alted_key = map_single[alted_key & EKEY_KEY_MASK];
     }
     return alted_key | EKEY_META;
-  } else if (sequence.size() == 1) {
+  } else if (length == 1) {
     return drop_single_esc ? -2 : EKEY_ESC;
   }
 
@@ -465,7 +600,6 @@ static key_t bracketed_paste_decode() {
         return EKEY_ESC;
       }
       if (idx == 6) {
-        in_bracketed_paste = false;
         return EKEY_PASTE_END;
       }
     }
@@ -481,7 +615,7 @@ static key_t bracketed_paste_decode() {
 
 void insert_protected_key(key_t key) {
   if (key >= 0) {
-    key_buffer.push_back(key | EKEY_PROTECT);
+    key_buffer.push_back_local(key | EKEY_PROTECT);
   }
 }
 
@@ -537,6 +671,7 @@ complex_error_t init_keys(const optional<std::string> &term, bool separate_keypa
   struct sigaction sa;
   sigset_t sigs;
   std::unique_ptr<const t3_key_node_t, t3_key_map_deleter> keymap;
+  std::map<std::string, key_t> map;
   const t3_key_node_t *key_node;
   int i, error;
   transcript_error_t transcript_error;
@@ -607,10 +742,8 @@ complex_error_t init_keys(const optional<std::string> &term, bool separate_keypa
   init_mouse_reporting(t3_key_get_named_node(keymap.get(), "_xterm_mouse") != nullptr);
 
   /* Load all the known keys from the terminfo database.
-     - find out how many sequences there are
-     - allocate an appropriate amount of memory
      - fill the map
-     - sort the map for quick searching
+     - compile the map into the trie used for decoding
   */
   for (key_node = keymap.get(); key_node != nullptr; key_node = key_node->next) {
     if (key_node->key[0] == '_') {
@@ -686,6 +819,8 @@ complex_error_t init_keys(const optional<std::string> &term, bool separate_keypa
     }
   }
 
+  sequences.build(map);
+
   read_key_thread = std::thread(read_keys);
 
 #ifdef DEBUG
@@ -741,7 +876,7 @@ void cleanup_keys() {
     transcript_close_converter(conversion_handle);
     conversion_handle = nullptr;
   }
-  map.clear();
+  sequences.clear();
   memset(map_single, 0, sizeof(map_single));
   leave.clear();
   enter.clear();
@@ -783,7 +918,7 @@ int get_key_timeout() {
   return key_timeout < 0 ? 0 : (drop_single_esc ? -key_timeout : key_timeout);
 }
 
-void signal_update() { key_buffer.push_back_unique(EKEY_EXTERNAL_UPDATE); }
+void signal_update() { key_buffer.post_event(EKEY_EXTERNAL_UPDATE); }
 
 void async_safe_exit_main_loop(int exit_code) {
   char exit_signal[2] = {EXIT_MAIN_LOOP_SIGNAL, static_cast<char>(exit_code & 0xff)};
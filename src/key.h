@@ -16,6 +16,7 @@
 
 #include <climits>
 #include <cstdint>
+#include <string>
 #include <t3widget/widget_api.h>
 
 namespace t3widget {
@@ -120,6 +121,11 @@ enum {
   EKEY_PASTE_START = EKEY_EXIT_MAIN_LOOP + 256,
   /** Pasted text stops. */
   EKEY_PASTE_END,
+  /** Key symbol indicating that a block of text was pasted.
+      While this key is being processed, the text is available through #get_pasted_text. If the
+      focused widget does not handle this key, the text is instead sent as a sequence of keys,
+      surrounded by @c EKEY_PASTE_START and @c EKEY_PASTE_END. */
+  EKEY_PASTE,
 
   /** Symbolic name for the escape key. */
   EKEY_ESC = 27,
@@ -135,8 +141,15 @@ enum {
   EKEY_KEY_MASK = 0x1fffff
 };
 
-/** Retrieve a key from the input queue. */
+/** Retrieve a key from the input queue.
+    The events @c EKEY_RESIZE, @c EKEY_EXTERNAL_UPDATE and @c EKEY_UPDATE_TERMINAL are not
+    queued like keys. They are returned ahead of any keys that are already in the queue, and
+    each is returned only once, however often it occurred since it was last returned. */
 T3_WIDGET_API key_t read_key();
+/** Retrieve the text that was pasted, while processing @c EKEY_PASTE.
+    The text is UTF-8 encoded. Carriage returns are converted to newlines, because terminals
+    convert newlines into carriage returns when pasting. */
+T3_WIDGET_API const std::string &get_pasted_text();
 /** Set the timeout for handling escape sequences.
 
     The value of the @p msec parameter can have the following values:
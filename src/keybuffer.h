@@ -18,76 +18,289 @@
 #error This header file is for internal use _only_!!
 #endif
 
-/* Buffer for storing keys that ensures thread-safe operation by means of a
-   mutex. It is implemented by means of a double ended queue.  */
+/* Buffers for passing keys and other input from the thread reading the terminal to the thread
+   running the main loop. Items are passed through a ring buffer that requires no locking. A mutex
+   is only used to put the consumer to sleep when there are no items, and to store items that do
+   not fit in the ring buffer. */
 
-#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <deque>
 #include <mutex>
+#include <string>
 #include <t3widget/key.h>
 #include <t3widget/mouse.h>
+#include <utility>
 
 namespace t3widget {
 
-/** Class implmementing a mutex-protected queue of items. */
-template <class T>
-class T3_WIDGET_LOCAL item_buffer_t {
- protected:
-  /** The list of item symbols. */
-  std::deque<T> items;
-  /** The mutex used for the critical section. */
+/** Class for putting the consuming thread to sleep until items are available. */
+class T3_WIDGET_LOCAL consumer_wakeup_t {
+ private:
+  /** The mutex used for sleeping. */
   std::mutex lock;
-  /** The condition variable used to signal addition to the #keys list. */
+  /** The condition variable used to signal the availability of items. */
   std::condition_variable cond;
+  /** Boolean indicating whether the consumer is (about to go) sleeping. */
+  std::atomic<bool> waiting{false};
 
  public:
-  /** Append an item to the list. */
-  void push_back(T item) {
+  /** Wake the consumer, if it is sleeping.
+      Must be called after making items available. The atomic operations used to make the items
+      available must be sequentially consistent, to ensure that either this function sees that
+      the consumer is waiting, or that the consumer sees the items. */
+  void notify() {
+    if (waiting) {
+      std::unique_lock<std::mutex> l(lock);
+      cond.notify_one();
+    }
+  }
+
+  /** Sleep until @p ready returns @c true. */
+  template <typename P>
+  void wait(P ready) {
+    std::unique_lock<std::mutex> l(lock);
+    waiting = true;
+    cond.wait(l, ready);
+    waiting = false;
+  }
+
+  /** Sleep until @p ready returns @c true, or @p deadline passes.
+      @return The last value returned by @p ready. */
+  template <typename P>
+  bool wait_until(std::chrono::steady_clock::time_point deadline, P ready) {
     std::unique_lock<std::mutex> l(lock);
-    /* Catch all exceptions, to enusre that unlocking of the mutex is
-       performed. The only real exception that can occur here is bad_alloc,
-       and there is not much we can do about that anyway. */
+    waiting = true;
+    bool result = cond.wait_until(l, deadline, ready);
+    waiting = false;
+    return result;
+  }
+};
+
+/** Class implementing a single-producer, single-consumer queue.
+
+    Items are stored in a ring buffer of @p N items. If the ring buffer is full, the producer
+    appends items to a mutex-protected overflow list instead, until the consumer has taken over
+    the whole overflow list. The queue therefore never blocks the producer. The consumer always
+    empties the ring buffer before taking over the overflow list, and it empties the taken over
+    list before looking at the ring buffer again, which keeps the items in order.
+*/
+template <class T, size_t N>
+class T3_WIDGET_LOCAL spsc_queue_t {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ private:
+  T items[N];
+  /** Number of items taken by the consumer. Only written by the consumer. */
+  std::atomic<size_t> head{0};
+  /** Number of items added by the producer. Only written by the producer. */
+  std::atomic<size_t> tail{0};
+
+  /** Boolean indicating whether the producer is appending to #overflow. */
+  std::atomic<bool> overflowed{false};
+  /** The mutex protecting #overflow. */
+  std::mutex overflow_lock;
+  std::deque<T> overflow;
+  /** Overflow items taken over by the consumer. Only accessed by the consumer. */
+  std::deque<T> spilled;
+
+ public:
+  /** Append an item. Must only be called from the producing thread. */
+  void push_back(T item) {
+    if (!overflowed) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) < N) {
+        items[t & (N - 1)] = std::move(item);
+        tail = t + 1;
+        return;
+      }
+    }
+    std::unique_lock<std::mutex> l(overflow_lock);
+    /* The only real exception that can occur here is bad_alloc, and there is not much we can
+       do about that anyway. */
     try {
-      items.push_back(item);
+      overflow.push_back(std::move(item));
     } catch (...) {
     }
-    cond.notify_one();
+    overflowed = true;
+  }
+
+  /** Retrieve and remove up to @p max items, without waiting. Must only be called from the
+      consuming thread.
+      @return The number of items stored in @p result. */
+  size_t pop_front(T *result, size_t max) {
+    size_t count = 0;
+    while (true) {
+      for (; count < max && !spilled.empty(); ++count) {
+        result[count] = std::move(spilled.front());
+        spilled.pop_front();
+      }
+
+      size_t h = head.load(std::memory_order_relaxed);
+      size_t t = tail.load(std::memory_order_acquire);
+      for (; count < max && h != t; ++count, ++h) {
+        result[count] = std::move(items[h & (N - 1)]);
+      }
+      head.store(h, std::memory_order_release);
+
+      /* The producer only sets overflowed after filling the ring buffer, so if the ring buffer
+         is still empty after seeing overflowed set, all items in the ring buffer are older than
+         the items in the overflow list. */
+      if (count == max || !overflowed || tail != h) {
+        return count;
+      }
+      std::unique_lock<std::mutex> l(overflow_lock);
+      spilled.swap(overflow);
+      overflowed = false;
+    }
+  }
+
+  /** Returns whether items are available. Must only be called from the consuming thread. */
+  bool available() const { return !spilled.empty() || head != tail || overflowed; }
+};
+
+/** Class implementing a queue of items, passed from a single producer to a single consumer. */
+template <class T, size_t N>
+class T3_WIDGET_LOCAL item_buffer_t {
+ private:
+  spsc_queue_t<T, N> items;
+  consumer_wakeup_t wakeup;
+
+ public:
+  /** Append an item. Must only be called from the producing thread. */
+  void push_back(T item) {
+    items.push_back(std::move(item));
+    wakeup.notify();
   }
 
-  /** Retrieve and remove the item at the front of the queue. */
+  /** Retrieve and remove the item at the front of the queue, waiting for it if necessary. */
   T pop_front() {
     T result;
-    std::unique_lock<std::mutex> l(lock);
-    while (items.empty()) cond.wait(l);
-    result = items.front();
-    items.pop_front();
+    while (items.pop_front(&result, 1) == 0) {
+      wakeup.wait([this] { return items.available(); });
+    }
     return result;
   }
 };
 
-/** Class implmementing a mutex-protected queue of key symbols. */
-class T3_WIDGET_LOCAL key_buffer_t : public item_buffer_t<key_t> {
+/** Class implementing the queue of key symbols.
+
+    Keys read from the terminal are passed from the input thread in batches through an
+    spsc_queue_t. Events that only need to be handled once, regardless of how often they occur,
+    are recorded as a set of flags, which can be set from any thread. These are returned before
+    the queued keys.
+*/
+class T3_WIDGET_LOCAL key_buffer_t {
+ private:
+  static constexpr size_t batch_size = 64;
+
+  spsc_queue_t<key_t, 1024> keys;
+  consumer_wakeup_t wakeup;
+  /** Bit set of pending events. See #event_key for the meaning of each bit. */
+  std::atomic<unsigned> pending_events{0};
+
+  /** Keys added by the consumer itself. */
+  std::deque<key_t> local_keys;
+  /** Batch of keys taken from #keys, but not returned yet. */
+  key_t batch[batch_size];
+  size_t batch_pos = 0, batch_fill = 0;
+
+  /** Number of distinct events in #pending_events. */
+  static constexpr unsigned event_count = 3;
+  /** Map a bit in #pending_events to its key symbol. */
+  static key_t event_key(unsigned bit) {
+    switch (bit) {
+      case 0:
+        return EKEY_RESIZE;
+      case 1:
+        return EKEY_EXTERNAL_UPDATE;
+      default:
+        return EKEY_UPDATE_TERMINAL;
+    }
+  }
+
+  bool available() const { return pending_events != 0 || keys.available(); }
+
+  /** Retrieve and remove the next key, without waiting. */
+  bool pop_available(key_t *key) {
+    if (!local_keys.empty()) {
+      *key = local_keys.front();
+      local_keys.pop_front();
+      return true;
+    }
+
+    unsigned pending = pending_events;
+    if (pending != 0) {
+      unsigned bit = 0;
+      while (!(pending & (1u << bit))) {
+        ++bit;
+      }
+      pending_events.fetch_and(~(1u << bit));
+      *key = event_key(bit);
+      return true;
+    }
+
+    if (batch_pos == batch_fill) {
+      batch_pos = 0;
+      batch_fill = keys.pop_front(batch, batch_size);
+      if (batch_fill == 0) {
+        return false;
+      }
+    }
+    *key = batch[batch_pos++];
+    return true;
+  }
+
  public:
-  /** Append an item to the list, but only if it is not already in the queue. */
-  void push_back_unique(key_t key) {
-    std::unique_lock<std::mutex> l(lock);
+  /** Append a key. Must only be called from the thread reading the terminal input. */
+  void push_back(key_t key) {
+    keys.push_back(key);
+    wakeup.notify();
+  }
 
-    // Return without adding if the key is already queued
-    if (find(items.begin(), items.end(), key) != items.end()) return;
+  /** Append a key from the thread that retrieves the keys. Keys added this way are returned
+      before the keys from the input thread. */
+  void push_back_local(key_t key) { local_keys.push_back(key); }
 
-    /* Catch all exceptions, to enusre that unlocking of the mutex is
-       performed. The only real exception that can occur here is bad_alloc,
-       and there is not much we can do about that anyway. */
-    try {
-      items.push_back(key);
-    } catch (...) {
+  /** Mark one of the events @c EKEY_RESIZE, @c EKEY_EXTERNAL_UPDATE or @c EKEY_UPDATE_TERMINAL
+      as pending. If the event is already pending, this has no effect. May be called from any
+      thread. */
+  void post_event(key_t key) {
+    for (unsigned bit = 0; bit < event_count; ++bit) {
+      if (event_key(bit) == key) {
+        pending_events.fetch_or(1u << bit);
+        wakeup.notify();
+        return;
+      }
+    }
+  }
+
+  /** Retrieve and remove the key at the front of the queue, waiting for it if necessary. */
+  key_t pop_front() {
+    key_t result;
+    while (!pop_available(&result)) {
+      wakeup.wait([this] { return available(); });
+    }
+    return result;
+  }
+
+  /** Retrieve and remove the key at the front of the queue, waiting at most until @p deadline.
+      @return @c true if a key was retrieved, @c false if the deadline passed first. If
+          @p deadline has already passed, only a key that is already queued is retrieved. */
+  bool pop_front_until(key_t *result, std::chrono::steady_clock::time_point deadline) {
+    while (!pop_available(result)) {
+      if (!wakeup.wait_until(deadline, [this] { return available(); })) {
+        return false;
+      }
     }
-    cond.notify_one();
+    return true;
   }
 };
 
-typedef item_buffer_t<mouse_event_t> mouse_event_buffer_t;
+typedef item_buffer_t<mouse_event_t, 256> mouse_event_buffer_t;
+typedef item_buffer_t<std::string, 16> paste_buffer_t;
 
 }  // namespace t3widget
 #endif
@@ -0,0 +1,394 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "t3widget/internal.h"
+#include "t3widget/linestore.h"
+#include "t3widget/modified_xxhash.h"
+#include "t3widget/string_view.h"
+#include "t3widget/textline.h"
+
+namespace t3widget {
+
+/* Maximum number of lines in a single chunk. Chunks are split when they grow
+   beyond this size, and merged with their neighbour when the two together hold
+   less than half this number of lines. */
+static const size_t max_chunk_size = 512;
+
+/** Read-only memory mapping of a file, unmapped on destruction. */
+class line_store_t::mapping_t {
+ public:
+  mapping_t(void *data, size_t size) : data_(data), size_(size) {}
+  ~mapping_t() { munmap(data_, size_); }
+
+  string_view get_text() const { return string_view(static_cast<const char *>(data_), size_); }
+
+ private:
+  void *data_;
+  size_t size_;
+};
+
+line_store_t::line_store_t() : valid_starts_(0), last_chunk_(0), size_(0), factory_(nullptr) {}
+
+line_store_t::~line_store_t() {}
+
+void line_store_t::invalidate_starts(size_t chunk) {
+  if (valid_starts_ > chunk + 1) {
+    valid_starts_ = chunk + 1;
+  }
+}
+
+line_store_t::value_type &line_store_t::get(text_pos_t idx) const {
+  size_t chunk = find_chunk(idx);
+  if (chunks_[chunk].unloaded_lines != 0) {
+    load_chunk(chunks_[chunk]);
+  }
+  return chunks_[chunk].lines[idx - chunk_starts_[chunk]];
+}
+
+size_t line_store_t::find_chunk(text_pos_t idx) const {
+  ASSERT(idx >= 0 && idx < size_);
+
+  if (valid_starts_ < chunks_.size()) {
+    text_pos_t start = valid_starts_ == 0
+                           ? 0
+                           : chunk_starts_[valid_starts_ - 1] + chunks_[valid_starts_ - 1].size();
+    for (size_t i = valid_starts_; i < chunks_.size(); ++i) {
+      chunk_starts_[i] = start;
+      start += chunks_[i].size();
+    }
+    valid_starts_ = chunks_.size();
+  }
+
+  if (last_chunk_ < chunks_.size() && idx >= chunk_starts_[last_chunk_] &&
+      idx < chunk_starts_[last_chunk_] + static_cast<text_pos_t>(chunks_[last_chunk_].size())) {
+    return last_chunk_;
+  }
+
+  last_chunk_ = std::upper_bound(chunk_starts_.begin(), chunk_starts_.end(), idx) -
+                chunk_starts_.begin() - 1;
+  return last_chunk_;
+}
+
+void line_store_t::load_chunk(chunk_t &chunk) const {
+  const char *data = chunk.unloaded_text.data();
+  const char *end = data + chunk.unloaded_text.size();
+
+  chunk.lines.reserve(std::max(chunk.unloaded_lines, max_chunk_size));
+  for (size_t i = 0; i < chunk.unloaded_lines; ++i) {
+    const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+    if (newline == nullptr) {
+      newline = end;
+    }
+    chunk.lines.push_back(factory_->new_text_line_t(string_view(data, newline - data)));
+    data = newline + 1;
+  }
+  chunk.unloaded_lines = 0;
+  chunk.unloaded_text = string_view();
+}
+
+void line_store_t::insert(text_pos_t idx, value_type line) {
+  ASSERT(idx >= 0 && idx <= size_);
+  size_t chunk;
+  size_t offset;
+
+  if (idx == size_) {
+    /* Appending is the common case when loading a file. Start a new chunk
+       instead of splitting the last one, to ensure chunks are completely
+       filled. */
+    if (chunks_.empty() || chunks_.back().size() >= max_chunk_size) {
+      chunks_.emplace_back();
+      chunks_.back().lines.reserve(max_chunk_size);
+      chunk_starts_.push_back(0);
+    }
+    chunk = chunks_.size() - 1;
+    offset = chunks_[chunk].size();
+  } else {
+    chunk = find_chunk(idx);
+    offset = idx - chunk_starts_[chunk];
+  }
+
+  if (chunks_[chunk].unloaded_lines != 0) {
+    load_chunk(chunks_[chunk]);
+  }
+  chunks_[chunk].lines.insert(chunks_[chunk].lines.begin() + offset, std::move(line));
+  ++size_;
+  invalidate_starts(chunk);
+
+  if (chunks_[chunk].size() > max_chunk_size) {
+    split_chunk(chunk);
+  }
+}
+
+void line_store_t::erase(text_pos_t first, text_pos_t last) {
+  ASSERT(first >= 0 && first <= last && last <= size_);
+  if (first == last) {
+    return;
+  }
+
+  const size_t first_chunk = find_chunk(first);
+  size_t chunk = first_chunk;
+  size_t offset = first - chunk_starts_[chunk];
+  text_pos_t count = last - first;
+
+  size_ -= count;
+  while (count > 0) {
+    chunk_t &current = chunks_[chunk];
+    size_t to_erase = std::min<size_t>(count, current.size() - offset);
+    if (to_erase == current.size()) {
+      chunks_.erase(chunks_.begin() + chunk);
+      chunk_starts_.erase(chunk_starts_.begin() + chunk);
+    } else {
+      if (current.unloaded_lines != 0) {
+        load_chunk(current);
+      }
+      current.lines.erase(current.lines.begin() + offset,
+                          current.lines.begin() + offset + to_erase);
+      ++chunk;
+    }
+    count -= to_erase;
+    offset = 0;
+  }
+
+  /* If the first chunk was removed, the start index of the chunk now in its
+     place is no longer correct either. */
+  if (valid_starts_ > first_chunk) {
+    valid_starts_ = first_chunk;
+  }
+
+  if (first_chunk < chunks_.size()) {
+    maybe_merge_chunk(first_chunk);
+  }
+  if (first_chunk > 0) {
+    maybe_merge_chunk(first_chunk - 1);
+  }
+}
+
+size_t line_store_t::hash() const {
+  size_t result = 0;
+  std::string normalized;
+  for (const chunk_t &chunk : chunks_) {
+    if (chunk.unloaded_lines == 0) {
+      for (const value_type &line : chunk.lines) {
+        const std::string &data = line->get_data();
+        result = ModifiedXXHash(data.data(), data.size(), result);
+      }
+      continue;
+    }
+    /* Split the text in the same way as load_chunk does. */
+    const char *data = chunk.unloaded_text.data();
+    const char *end = data + chunk.unloaded_text.size();
+    for (size_t i = 0; i < chunk.unloaded_lines; ++i) {
+      const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+      if (newline == nullptr) {
+        newline = end;
+      }
+      /* Hash the text as it will be stored once the line is loaded. */
+      string_view line(data, newline - data);
+      if (valid_utf8_prefix(line) == line.size()) {
+        result = ModifiedXXHash(line.data(), line.size(), result);
+      } else {
+        normalized.clear();
+        append_utf8_normalized(&normalized, line);
+        result = ModifiedXXHash(normalized.data(), normalized.size(), result);
+      }
+      data = newline + 1;
+    }
+  }
+  return ModifiedXXHash(&size_, sizeof(size_), result);
+}
+
+std::unique_ptr<line_store_t::snapshot_t> line_store_t::snapshot() const {
+  std::unique_ptr<snapshot_t> result(new snapshot_t());
+  result->mapping_ = mapping_;
+  result->size_ = size_;
+
+  text_pos_t first_line = 0;
+  for (const chunk_t &chunk : chunks_) {
+    std::unique_ptr<snapshot_t::segment_t> segment(new snapshot_t::segment_t());
+    segment->first_line = first_line;
+    segment->line_count = chunk.size();
+    segment->loaded = chunk.unloaded_lines == 0;
+    if (segment->loaded) {
+      std::string &text = segment->copied_text;
+      segment->starts.reserve(chunk.lines.size() + 1);
+      for (const value_type &line : chunk.lines) {
+        if (!segment->starts.empty()) {
+          text += '\n';
+        }
+        segment->starts.push_back(text.size());
+        text += line->get_data();
+      }
+      segment->starts.push_back(text.size() + 1);
+      segment->text = text;
+    } else {
+      segment->text = chunk.unloaded_text;
+    }
+    first_line += chunk.size();
+    result->segments_.push_back(std::move(segment));
+  }
+  return result;
+}
+
+void line_store_t::snapshot_t::get_line(text_pos_t idx, std::string *line) const {
+  ASSERT(idx >= 0 && idx < size_);
+  auto segment_iter = std::upper_bound(
+      segments_.begin(), segments_.end(), idx,
+      [](text_pos_t i, const std::unique_ptr<segment_t> &seg) { return i < seg->first_line; });
+  segment_t &segment = **std::prev(segment_iter);
+
+  std::call_once(segment.starts_located, [&segment] {
+    if (!segment.starts.empty()) {
+      return;
+    }
+    /* Split the text in the same way as load_chunk does. */
+    const char *data = segment.text.data();
+    const char *end = data + segment.text.size();
+    segment.starts.reserve(segment.line_count + 1);
+    for (size_t i = 0; i < segment.line_count; ++i) {
+      segment.starts.push_back(data - segment.text.data());
+      const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+      data = newline == nullptr ? end + 1 : newline + 1;
+    }
+    segment.starts.push_back(segment.text.size() + 1);
+  });
+
+  size_t offset = idx - segment.first_line;
+  string_view text = segment.text.substr(
+      segment.starts[offset], segment.starts[offset + 1] - segment.starts[offset] - 1);
+  if (segment.loaded || valid_utf8_prefix(text) == text.size()) {
+    line->assign(text.data(), text.size());
+  } else {
+    line->clear();
+    append_utf8_normalized(line, text);
+  }
+}
+
+int line_store_t::load_file(const std::string &name, text_line_factory_t *factory) {
+  struct stat file_info;
+  void *data = nullptr;
+  int fd;
+
+  if ((fd = open(name.c_str(), O_RDONLY)) < 0) {
+    return errno;
+  }
+
+  if (fstat(fd, &file_info) < 0) {
+    int saved_errno = errno;
+    close(fd);
+    return saved_errno;
+  }
+
+  if (!S_ISREG(file_info.st_mode)) {
+    close(fd);
+    return S_ISDIR(file_info.st_mode) ? EISDIR : EINVAL;
+  }
+
+  if (file_info.st_size > 0) {
+    data = mmap(nullptr, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int saved_errno = errno;
+      close(fd);
+      return saved_errno;
+    }
+  }
+  close(fd);
+
+  chunks_.clear();
+  chunk_starts_.clear();
+  valid_starts_ = 0;
+  last_chunk_ = 0;
+  size_ = 0;
+  factory_ = factory;
+  mapping_.reset(data == nullptr ? nullptr : new mapping_t(data, file_info.st_size));
+
+  if (mapping_ == nullptr) {
+    push_back(factory->new_text_line_t());
+    return 0;
+  }
+
+  /* Only locate the line endings, to determine the number of lines and the
+     boundaries of the chunks. The text_line_t objects are created when the
+     chunk is first accessed. */
+  string_view text = mapping_->get_text();
+  const char *ptr = text.data();
+  const char *end = ptr + text.size();
+  while (true) {
+    chunk_t chunk;
+    const char *chunk_start = ptr;
+    const char *newline = nullptr;
+    while (chunk.unloaded_lines < max_chunk_size) {
+      ++chunk.unloaded_lines;
+      newline = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+      if (newline == nullptr) {
+        break;
+      }
+      ptr = newline + 1;
+    }
+    chunk.unloaded_text =
+        string_view(chunk_start, (newline == nullptr ? end : newline) - chunk_start);
+    size_ += chunk.unloaded_lines;
+    chunks_.push_back(std::move(chunk));
+    chunk_starts_.push_back(0);
+    if (newline == nullptr) {
+      break;
+    }
+  }
+  return 0;
+}
+
+void line_store_t::split_chunk(size_t chunk) {
+  chunk_t second_half;
+  second_half.lines.reserve(max_chunk_size);
+  std::vector<value_type> &lines = chunks_[chunk].lines;
+  size_t half = lines.size() / 2;
+  std::move(lines.begin() + half, lines.end(), std::back_inserter(second_half.lines));
+  lines.erase(lines.begin() + half, lines.end());
+
+  chunks_.insert(chunks_.begin() + chunk + 1, std::move(second_half));
+  chunk_starts_.insert(chunk_starts_.begin() + chunk + 1, 0);
+  invalidate_starts(chunk);
+}
+
+void line_store_t::maybe_merge_chunk(size_t chunk) {
+  if (chunk + 1 >= chunks_.size() ||
+      chunks_[chunk].size() + chunks_[chunk + 1].size() > max_chunk_size / 2) {
+    return;
+  }
+
+  for (size_t i = chunk; i <= chunk + 1; ++i) {
+    if (chunks_[i].unloaded_lines != 0) {
+      load_chunk(chunks_[i]);
+    }
+  }
+  std::move(chunks_[chunk + 1].lines.begin(), chunks_[chunk + 1].lines.end(),
+            std::back_inserter(chunks_[chunk].lines));
+  chunks_.erase(chunks_.begin() + chunk + 1);
+  chunk_starts_.erase(chunk_starts_.begin() + chunk + 1);
+  invalidate_starts(chunk);
+}
+
+}  // namespace t3widget
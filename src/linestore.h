@@ -0,0 +1,181 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_LINESTORE_H
+#define T3_WIDGET_LINESTORE_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <t3widget/string_view.h>
+#include <t3widget/textline.h>
+#include <t3widget/util.h>
+#include <t3widget/widget_api.h>
+#include <vector>
+
+namespace t3widget {
+
+/** Storage for the lines of a text_buffer_t.
+
+    The lines are kept in a list of chunks, each holding at most a fixed number
+    of lines. Inserting or deleting a line therefore only shifts the lines in a
+    single chunk, instead of all lines following it as with a plain
+    @c std::vector. To find the chunk containing a line, the start index of each
+    chunk is stored. These start indices are only recalculated on the next
+    look-up after a modification, and only from the first modified chunk
+    onwards.
+
+    Lines read using #load_file are not converted to text_line_t objects
+    immediately. Instead, each chunk refers to the memory mapped file contents,
+    and is only converted when one of its lines is first accessed.
+
+    The interface mimics the subset of @c std::vector used by text_buffer_t, but
+    uses indices instead of iterators.
+*/
+class T3_WIDGET_LOCAL line_store_t {
+ public:
+  typedef std::unique_ptr<text_line_t> value_type;
+
+  line_store_t();
+  ~line_store_t();
+
+  /** Retrieve the number of lines in the store. */
+  text_pos_t size() const { return size_; }
+
+  value_type &operator[](text_pos_t idx) { return get(idx); }
+  const value_type &operator[](text_pos_t idx) const { return get(idx); }
+
+  /** Insert @p line before the line at @p idx. */
+  void insert(text_pos_t idx, value_type line);
+  /** Remove the lines in the range [@p first, @p last). */
+  void erase(text_pos_t first, text_pos_t last);
+  /** Add @p line at the end of the store. */
+  void push_back(value_type line) { insert(size_, std::move(line)); }
+
+  /** Replace the contents of the store by the contents of the file @p name.
+      @param name The name of the file to load.
+      @param factory The factory used to create text_line_t objects when lines are accessed.
+      @return 0 on success, or an @c errno value on failure.
+
+      The file is mapped into memory read-only, and only scanned for line
+      endings. It must be a regular file which is not truncated while it is
+      in use.
+  */
+  int load_file(const std::string &name, text_line_factory_t *factory);
+
+  class snapshot_t;
+  /** Create an immutable copy of the text of all lines, which may be read from other threads.
+      Chunks that have not been converted to text_line_t objects yet are not copied, and are not
+      converted by this function either. */
+  std::unique_ptr<snapshot_t> snapshot() const;
+
+  /** Compute a hash of the text of all lines.
+      Lines that have not been converted to text_line_t objects yet are hashed
+      without converting them, but invalid UTF-8 is replaced as it would be when
+      converting, so the result does not depend on which lines were accessed.
+      Like ModifiedXXHash, the result is only the same for the same text on the
+      same platform. */
+  size_t hash() const;
+
+ private:
+  class mapping_t;
+
+  struct chunk_t {
+    std::vector<value_type> lines;
+    /* The text of the lines in this chunk, if they have not been converted to
+       text_line_t objects yet. */
+    string_view unloaded_text;
+    size_t unloaded_lines;
+
+    chunk_t() : unloaded_lines(0) {}
+    size_t size() const { return unloaded_lines == 0 ? lines.size() : unloaded_lines; }
+  };
+
+  /** Retrieve line @p idx, converting its chunk to text_line_t objects if necessary. */
+  value_type &get(text_pos_t idx) const;
+  /** Find the chunk holding line @p idx, updating the chunk start indices if required. */
+  size_t find_chunk(text_pos_t idx) const;
+  /** Convert the text of the lines in @p chunk to text_line_t objects. */
+  void load_chunk(chunk_t &chunk) const;
+  /** Split chunk @p chunk in two halves. */
+  void split_chunk(size_t chunk);
+  /** Merge chunk @p chunk with the next chunk if the two together are small enough. */
+  void maybe_merge_chunk(size_t chunk);
+  /** Mark the chunk start indices of all chunks after @p chunk as invalid. */
+  void invalidate_starts(size_t chunk);
+
+  /* Chunks are converted to text_line_t objects on first access, which may be
+     through a const member function. */
+  mutable std::vector<chunk_t> chunks_;
+  mutable std::vector<text_pos_t> chunk_starts_;
+  /* Index of the first chunk for which the value in chunk_starts_ may be incorrect. */
+  mutable size_t valid_starts_;
+  /* Chunk found in the last look-up. Most look-ups are for lines near the previous one. */
+  mutable size_t last_chunk_;
+  text_pos_t size_;
+
+  /* Shared with the snapshots referring to the mapped text. */
+  std::shared_ptr<mapping_t> mapping_;
+  text_line_factory_t *factory_;
+};
+
+/** Immutable copy of the text of a line_store_t, created by line_store_t::snapshot.
+
+    The text of chunks that were converted to text_line_t objects is copied. Chunks that were
+    not converted yet refer to the memory mapped file instead, which is kept mapped for as long
+    as the snapshot exists. The start of each line in such a chunk is only located when a line
+    of the chunk is first retrieved.
+
+    All member functions may be called from any thread.
+*/
+class T3_WIDGET_LOCAL line_store_t::snapshot_t {
+ public:
+  /** Retrieve the number of lines in the snapshot. */
+  text_pos_t size() const { return size_; }
+  /** Retrieve the text of line @p idx in @p line, as it is (or would be) stored in a
+      text_line_t. */
+  void get_line(text_pos_t idx, std::string *line) const;
+
+ private:
+  friend class line_store_t;
+
+  /* The lines of a single chunk. */
+  struct segment_t {
+    text_pos_t first_line;
+    size_t line_count;
+    /* The text of the lines, separated by newline characters. */
+    string_view text;
+    /* Storage for text, if it was copied. */
+    std::string copied_text;
+    /* Whether text was copied from text_line_t objects, and therefore needs no conversion. */
+    bool loaded;
+    /* The start of each line in text, followed by the size of text plus one. For chunks that
+       were not converted yet, this is filled on first use. */
+    std::vector<size_t> starts;
+    std::once_flag starts_located;
+  };
+
+  snapshot_t() : size_(0) {}
+
+  std::shared_ptr<const mapping_t> mapping_;
+  std::vector<std::unique_ptr<segment_t>> segments_;
+  text_pos_t size_;
+};
+
+}  // namespace t3widget
+#endif
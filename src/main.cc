@@ -13,6 +13,7 @@
 */
 
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
@@ -46,6 +47,7 @@
 #include "t3widget/textline.h"
 #include "t3widget/util.h"
 #include "t3window/terminal.h"
+#include "t3window/utf8.h"
 
 namespace t3widget {
 #define MESSAGE_DIALOG_WIDTH 50
@@ -56,6 +58,11 @@ static int init_level;
 static int screen_lines, screen_columns;
 static signal_t<int, int> resize;
 static signal_t<> update_notification;
+/* Text of the paste currently being processed. */
+static std::string pasted_text;
+/* Minimum time between two terminal updates. */
+static std::chrono::steady_clock::duration frame_interval =
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / 60;
 
 init_parameters_t *init_params;
 bool disable_primary_selection;
@@ -381,15 +388,24 @@ complex_error_t init(const init_parameters_t *params) {
 
 void iterate() {
   static bool should_draw_mouse_cursor = false;
+  static std::chrono::steady_clock::time_point next_update;
   key_t key;
   mouse_event_t mouse_event;
 
-  dialog_t::update_dialogs();
-  t3_term_update();
-  if (should_draw_mouse_cursor) {
-    draw_mouse_cursor(mouse_event);
+  /* Keys that arrive before the next update is due are processed without updating the terminal,
+     such that a burst of keys results in a single update. If no key arrives before the update is
+     due, the terminal is updated before waiting for the next key. Thus the terminal is always up
+     to date when the input is idle, while during a continuous stream of keys the terminal is
+     still updated once per frame_interval. */
+  if (std::chrono::steady_clock::now() >= next_update || !read_key_until(&key, next_update)) {
+    dialog_t::update_dialogs();
+    t3_term_update();
+    if (should_draw_mouse_cursor) {
+      draw_mouse_cursor(mouse_event);
+    }
+    next_update = std::chrono::steady_clock::now() + frame_interval;
+    key = read_key();
   }
-  key = read_key();
   if (key == EKEY_MOUSE_EVENT) {
     should_draw_mouse_cursor = true;
     mouse_event = read_mouse_event();
@@ -409,6 +425,21 @@ void iterate() {
       case EKEY_UPDATE_TERMINAL:
         terminal_settings_changed()();
         break;
+      case EKEY_PASTE:
+        pasted_text = read_pasted_text();
+        if (!dialog_t::active_dialogs.back()->process_key(EKEY_PASTE)) {
+          /* The focused widget does not handle pasted blocks, so send the text as keys. */
+          dialog_t::active_dialogs.back()->process_key(EKEY_PASTE_START);
+          for (size_t i = 0; i < pasted_text.size();) {
+            size_t bytes_read = pasted_text.size() - i;
+            key_t c = t3_utf8_get(pasted_text.data() + i, &bytes_read);
+            i += bytes_read;
+            dialog_t::active_dialogs.back()->process_key(c == '\n' ? EKEY_NL : EKEY_PROTECT | c);
+          }
+          dialog_t::active_dialogs.back()->process_key(EKEY_PASTE_END);
+        }
+        std::string().swap(pasted_text);
+        break;
       default:
         if (key >= EKEY_EXIT_MAIN_LOOP && key <= EKEY_EXIT_MAIN_LOOP + 255) {
           exit_main_loop(key - EKEY_EXIT_MAIN_LOOP);
@@ -468,6 +499,26 @@ void redraw() {
   t3_term_redraw();
 }
 
+void set_max_frame_rate(int fps) {
+  if (fps <= 0) {
+    frame_interval = std::chrono::steady_clock::duration::zero();
+  } else {
+    frame_interval =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) /
+        fps;
+  }
+}
+
+int get_max_frame_rate() {
+  if (frame_interval == std::chrono::steady_clock::duration::zero()) {
+    return 0;
+  }
+  return static_cast<int>(std::chrono::steady_clock::duration(std::chrono::seconds(1)) /
+                          frame_interval);
+}
+
+const std::string &get_pasted_text() { return pasted_text; }
+
 long get_version() { return T3_WIDGET_VERSION; }
 
 long get_libt3key_version() { return t3_key_get_version(); }
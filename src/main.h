@@ -126,6 +126,10 @@ T3_WIDGET_API void restore();
     This function updates the contents of the terminal, waits for a key press
         and sends it to the currently focussed dialog. Called repeatedly from
     #main_loop.
+
+    The terminal is only updated if no key is pending, or if the last update was longer ago than
+    allowed by #set_max_frame_rate. Therefore, a burst of keys is handled with a single update of
+    the terminal.
 */
 T3_WIDGET_API void iterate();
 /** Run the main event loop of the libt3widget library.
@@ -146,6 +150,17 @@ T3_WIDGET_API void suspend();
 */
 T3_WIDGET_API void redraw();
 
+/** Set the maximum number of terminal updates per second.
+    While keys keep arriving, the terminal is updated at most @p fps times per second. When no
+    more keys arrive, the terminal is updated immediately. The default is 60. A value of 0 or less
+    disables the limit, which causes the terminal to be updated before handling each key.
+*/
+T3_WIDGET_API void set_max_frame_rate(int fps);
+/** Get the maximum number of terminal updates per second.
+    See #set_max_frame_rate for details. Returns 0 if the limit is disabled.
+*/
+T3_WIDGET_API int get_max_frame_rate();
+
 /** Exit the main loop.
     Calling this function will cause an exit from the main loop. This is
     accomplished by throwing an exception, so using an unqualified @c catch
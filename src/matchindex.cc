@@ -0,0 +1,445 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "t3widget/findcontext.h"
+#include "t3widget/internal.h"
+#include "t3widget/key.h"
+#include "t3widget/linestore.h"
+#include "t3widget/main.h"
+#include "t3widget/matchindex.h"
+#include "t3widget/signals.h"
+#include "t3widget/textbuffer.h"
+#include "t3widget/textbuffer_impl.h"
+#include "t3widget/textline.h"
+#include "t3widget/util.h"
+
+namespace t3widget {
+
+namespace {
+
+/* Start and end of a match within its line. */
+struct match_pos_t {
+  text_pos_t start, end;
+};
+
+/* The matches of a single line, ordered by start position. */
+typedef std::vector<match_pos_t> line_matches_t;
+
+/* Stores all matches in data, the text of a line, in result. */
+void find_matches(finder_t *finder, const std::string &data, line_matches_t *result) {
+  find_result_t match;
+  match.start.pos = -1;
+  match.end.pos = -1;
+  result->clear();
+  while (finder->match(data, &match, false)) {
+    result->push_back(match_pos_t{match.start.pos, match.end.pos});
+    if (static_cast<size_t>(match.end.pos) >= data.size()) {
+      break;
+    }
+    /* Searching from the end of the previous match excludes empty matches at that point, so
+       the search always makes progress, but does find a non-empty match directly following the
+       previous match. */
+    match.start.pos = match.end.pos;
+    match.end.pos = -1;
+  }
+}
+
+/* State of the background thread locating the matches in a snapshot of the text. */
+struct indexer_t {
+  std::unique_ptr<line_store_t::snapshot_t> lines;
+  std::unique_ptr<finder_t> finder;
+  /* The lines with at least one match, in order, with their matches. */
+  std::vector<std::pair<text_pos_t, line_matches_t>> matches;
+  std::atomic<bool> cancelled;
+  std::atomic<bool> done;
+  std::thread worker;
+
+  indexer_t() : cancelled(false), done(false) {}
+
+  void run() {
+    std::string line;
+    line_matches_t line_matches;
+    for (text_pos_t i = 0; i < lines->size(); ++i) {
+      if (cancelled) {
+        return;
+      }
+      lines->get_line(i, &line);
+      find_matches(finder.get(), line, &line_matches);
+      if (!line_matches.empty()) {
+        matches.emplace_back(i, std::move(line_matches));
+        line_matches = line_matches_t();
+      }
+    }
+    done = true;
+    signal_update();
+  }
+};
+
+/* A change to the text, as reported through the rewrap_required signal. */
+struct change_t {
+  rewrap_type_t type;
+  text_pos_t a, b;
+};
+
+}  // namespace
+
+/* The matches are stored per line, such that a change to a line only affects the matches of that
+   line, and inserting or deleting lines does not affect the matches of other lines. As most lines
+   have no matches, the information stored for each line is kept as small as possible. Only lines
+   with matches use a separately allocated list of matches.
+
+   To find the number of a match, a Fenwick tree (binary indexed tree) of the number of matches
+   of each line is kept, as wrap_info_t does for the number of sub-lines. It is updated in place
+   when the matches of a single line change, and rebuilt when it is next needed after lines were
+   inserted or deleted. */
+struct match_index_t::implementation_t {
+  text_buffer_t *text;
+  /* The finder used for the lines that change. This is either owned_finder, or if the finder
+     passed to the constructor can not be cloned, that finder. */
+  finder_t *finder;
+  std::unique_ptr<finder_t> owned_finder;
+  /* For each line, zero if the line has no matches. Otherwise one more than the index of the
+     matches of the line in extra_matches. */
+  std::vector<uint32_t> match_data;
+  /* The matches of the lines that have at least one match. Unused entries are empty, and their
+     indices are listed in free_matches. */
+  std::vector<line_matches_t> extra_matches;
+  std::vector<uint32_t> free_matches;
+  /* Total number of matches. */
+  size_t size;
+  /* Fenwick tree of the match counts, using 1-based indices. Element i holds the sum of the match
+     counts of lines [i - (i & -i), i). */
+  mutable std::vector<size_t> match_count_tree;
+  mutable bool match_count_tree_valid;
+  /* The background search, while it is running. */
+  std::unique_ptr<indexer_t> indexer;
+  /* Changes made to the text while the background search is running. */
+  std::vector<change_t> changes;
+  connection_t change_connection;
+  connection_t update_connection;
+  signal_t<> indexed;
+
+  explicit implementation_t(text_buffer_t *_text)
+      : text(_text), finder(nullptr), size(0), match_count_tree_valid(false) {}
+
+  size_t match_count(text_pos_t line) const {
+    uint32_t matches = match_data[line];
+    return matches == 0 ? 0 : extra_matches[matches - 1].size();
+  }
+
+  /* Replace the matches of line by those in matches, leaving the previous matches in matches. */
+  void set_matches(text_pos_t line, line_matches_t *matches) {
+    uint32_t &data = match_data[line];
+    const size_t old_count = match_count(line);
+    if (matches->empty()) {
+      if (data != 0) {
+        extra_matches[data - 1].swap(*matches);
+        line_matches_t().swap(extra_matches[data - 1]);
+        free_matches.push_back(data - 1);
+        data = 0;
+      }
+    } else if (data != 0) {
+      extra_matches[data - 1].swap(*matches);
+    } else {
+      if (free_matches.empty()) {
+        data = extra_matches.size();
+        extra_matches.emplace_back();
+      } else {
+        data = free_matches.back();
+        free_matches.pop_back();
+      }
+      extra_matches[data].swap(*matches);
+      ++data;
+    }
+    const size_t new_count = match_count(line);
+    size += new_count - old_count;
+    update_match_count(line, new_count - old_count);
+  }
+
+  /* Search line again, and replace its matches. */
+  void find_line_matches(text_pos_t line) {
+    line_matches_t matches;
+    find_matches(finder, text->get_line_data(line).get_data(), &matches);
+    set_matches(line, &matches);
+  }
+
+  void delete_lines(text_pos_t first, text_pos_t last) {
+    line_matches_t empty;
+    for (text_pos_t i = first; i < last; ++i) {
+      set_matches(i, &empty);
+      empty.clear();
+    }
+    match_data.erase(match_data.begin() + first, match_data.begin() + last);
+    match_count_tree_valid = false;
+  }
+
+  /* Insert lines without matches. */
+  void insert_lines(text_pos_t first, text_pos_t last) {
+    match_data.insert(match_data.begin() + first, last - first, 0);
+    match_count_tree_valid = false;
+  }
+
+  /* Add change, which may be negative, to the match count of line. */
+  void update_match_count(text_pos_t line, size_t change) const {
+    if (!match_count_tree_valid || change == 0) {
+      return;
+    }
+    const size_t tree_size = match_count_tree.size();
+    for (size_t i = line + 1; i < tree_size; i += i & -i) {
+      match_count_tree[i] += change;
+    }
+  }
+
+  void build_match_count_tree() const {
+    const size_t tree_size = match_data.size() + 1;
+    match_count_tree.resize(tree_size);
+    match_count_tree[0] = 0;
+    for (size_t i = 1; i < tree_size; ++i) {
+      match_count_tree[i] = match_count(i - 1);
+    }
+    /* Linear time construction: add each node to its parent. */
+    for (size_t i = 1; i < tree_size; ++i) {
+      size_t parent = i + (i & -i);
+      if (parent < tree_size) {
+        match_count_tree[parent] += match_count_tree[i];
+      }
+    }
+    match_count_tree_valid = true;
+  }
+
+  /* Returns the number of matches on the lines before line. */
+  size_t matches_before(text_pos_t line) const {
+    if (!match_count_tree_valid) {
+      build_match_count_tree();
+    }
+    size_t result = 0;
+    for (size_t i = line; i > 0; i -= i & -i) {
+      result += match_count_tree[i];
+    }
+    return result;
+  }
+
+  /* Returns the line containing match number idx, and stores the index of the match within that
+     line in idx. */
+  text_pos_t find_match_line(size_t *idx) const {
+    if (!match_count_tree_valid) {
+      build_match_count_tree();
+    }
+    /* Find the last line for which the number of matches before it is at most idx, by
+       descending the tree. Lines without matches are skipped, as the number of matches before
+       the next line is the same. */
+    const size_t tree_size = match_count_tree.size();
+    size_t step = 1;
+    while (step * 2 < tree_size) {
+      step *= 2;
+    }
+    size_t line = 0;
+    for (; step > 0; step /= 2) {
+      if (line + step < tree_size && match_count_tree[line + step] <= *idx) {
+        line += step;
+        *idx -= match_count_tree[line];
+      }
+    }
+    return line;
+  }
+
+  void stop_indexer() {
+    if (indexer == nullptr) {
+      return;
+    }
+    indexer->cancelled = true;
+    indexer->worker.join();
+    indexer.reset();
+  }
+
+  void check_done() {
+    if (indexer == nullptr || !indexer->done) {
+      return;
+    }
+    indexer->worker.join();
+    match_data.assign(indexer->lines->size(), 0);
+    match_count_tree_valid = false;
+    for (std::pair<text_pos_t, line_matches_t> &line : indexer->matches) {
+      set_matches(line.first, &line.second);
+    }
+    indexer.reset();
+    apply_changes();
+    indexed();
+  }
+
+  /* Applies the changes made while the background search was running to its matches. The text
+     of a changed line is only known as it is now, so changed lines are only tracked while the
+     changes are applied, and searched once all lines are at their current position. */
+  void apply_changes() {
+    std::vector<text_pos_t> changed_lines;
+    for (const change_t &change : changes) {
+      switch (change.type) {
+        case rewrap_type_t::REWRAP_LINE:
+        case rewrap_type_t::REWRAP_LINE_LOCAL:
+          changed_lines.push_back(change.a);
+          break;
+        case rewrap_type_t::REWRAP_LINES:
+          for (text_pos_t i = change.a; i < change.b; ++i) {
+            changed_lines.push_back(i);
+          }
+          break;
+        case rewrap_type_t::INSERT_LINES:
+          insert_lines(change.a, change.b);
+          for (text_pos_t &line : changed_lines) {
+            if (line >= change.a) {
+              line += change.b - change.a;
+            }
+          }
+          for (text_pos_t i = change.a; i < change.b; ++i) {
+            changed_lines.push_back(i);
+          }
+          break;
+        case rewrap_type_t::DELETE_LINES:
+          delete_lines(change.a, change.b);
+          changed_lines.erase(std::remove_if(changed_lines.begin(), changed_lines.end(),
+                                             [&change](text_pos_t line) {
+                                               return line >= change.a && line < change.b;
+                                             }),
+                              changed_lines.end());
+          for (text_pos_t &line : changed_lines) {
+            if (line >= change.b) {
+              line -= change.b - change.a;
+            }
+          }
+          break;
+        default:
+          ASSERT(false);
+      }
+    }
+    changes.clear();
+
+    std::sort(changed_lines.begin(), changed_lines.end());
+    changed_lines.erase(std::unique(changed_lines.begin(), changed_lines.end()),
+                        changed_lines.end());
+    for (text_pos_t line : changed_lines) {
+      find_line_matches(line);
+    }
+  }
+
+  void update(rewrap_type_t type, text_pos_t a, text_pos_t b) {
+    if (indexer != nullptr) {
+      /* The changes are applied once the background search is done. Changes of only the wrapping
+         have no influence on the matches. */
+      if (type != rewrap_type_t::REWRAP_ALL) {
+        changes.push_back(change_t{type, a, b});
+      }
+      return;
+    }
+
+    switch (type) {
+      case rewrap_type_t::REWRAP_ALL:
+        // Only the wrapping changed, which has no influence on the matches.
+        break;
+      case rewrap_type_t::REWRAP_LINE:
+      case rewrap_type_t::REWRAP_LINE_LOCAL:
+        find_line_matches(a);
+        break;
+      case rewrap_type_t::INSERT_LINES:
+        insert_lines(a, b);
+        for (text_pos_t i = a; i < b; ++i) {
+          find_line_matches(i);
+        }
+        break;
+      case rewrap_type_t::DELETE_LINES:
+        delete_lines(a, b);
+        break;
+      case rewrap_type_t::REWRAP_LINES:
+        for (text_pos_t i = a; i < b; ++i) {
+          find_line_matches(i);
+        }
+        break;
+      default:
+        ASSERT(false);
+    }
+  }
+};
+
+match_index_t::match_index_t(text_buffer_t *text, finder_t *finder)
+    : impl(new implementation_t(text)) {
+  impl->owned_finder = finder->clone();
+  impl->finder = impl->owned_finder == nullptr ? finder : impl->owned_finder.get();
+
+  std::unique_ptr<finder_t> indexer_finder = finder->clone();
+  if (indexer_finder == nullptr) {
+    /* The finder can not be used from another thread, so locate the matches here instead. */
+    impl->match_data.assign(text->size(), 0);
+    for (text_pos_t i = 0; i < text->size(); ++i) {
+      impl->find_line_matches(i);
+    }
+  } else {
+    impl->indexer = t3widget::make_unique<indexer_t>();
+    /* Taking the snapshot only copies the lines that were loaded, and does not load the others. */
+    impl->indexer->lines = text->impl->lines.snapshot();
+    impl->indexer->finder = std::move(indexer_finder);
+    impl->indexer->worker = std::thread(&indexer_t::run, impl->indexer.get());
+    impl->update_connection =
+        connect_update_notification(bind_front(&implementation_t::check_done, impl.get()));
+  }
+  impl->change_connection =
+      text->connect_rewrap_required(bind_front(&implementation_t::update, impl.get()));
+}
+
+match_index_t::~match_index_t() {
+  impl->change_connection.disconnect();
+  impl->update_connection.disconnect();
+  impl->stop_indexer();
+}
+
+bool match_index_t::is_complete() const { return impl->indexer == nullptr; }
+
+size_t match_index_t::size() const { return impl->size; }
+
+find_result_t match_index_t::get_match(size_t idx) const {
+  text_pos_t line = impl->find_match_line(&idx);
+  const match_pos_t &match = impl->extra_matches[impl->match_data[line] - 1][idx];
+  find_result_t result;
+  result.start = text_coordinate_t(line, match.start);
+  result.end = text_coordinate_t(line, match.end);
+  return result;
+}
+
+size_t match_index_t::find_match(text_coordinate_t pos) const {
+  if (static_cast<size_t>(pos.line) >= impl->match_data.size()) {
+    return impl->size;
+  }
+  size_t result = impl->matches_before(pos.line);
+  uint32_t matches = impl->match_data[pos.line];
+  if (matches != 0) {
+    const line_matches_t &line_matches = impl->extra_matches[matches - 1];
+    result += std::lower_bound(line_matches.begin(), line_matches.end(), pos.pos,
+                               [](const match_pos_t &match, text_pos_t value) {
+                                 return match.start < value;
+                               }) -
+              line_matches.begin();
+  }
+  return result;
+}
+
+_T3_WIDGET_IMPL_SIGNAL(match_index_t, indexed)
+
+}  // namespace t3widget
@@ -0,0 +1,77 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_MATCHINDEX_H
+#define T3_WIDGET_MATCHINDEX_H
+
+#include <cstddef>
+#include <t3widget/findcontext.h>
+#include <t3widget/signals.h>
+#include <t3widget/textbuffer.h>
+#include <t3widget/util.h>
+#include <t3widget/widget_api.h>
+
+namespace t3widget {
+
+/** Class holding all matches of a finder_t in a text_buffer_t.
+
+    The matches are located by a background thread, which searches a snapshot of the text taken
+    when the match_index_t is created. Until it is done, the index is empty and #is_complete
+    returns @c false. Changes made to the text in the mean time are applied when the matches are
+    taken over from the background thread. After that, the index is kept up to date by only
+    searching the lines reported as changed through the @c rewrap_required signal of the
+    text_buffer_t. This makes it suitable for highlighting all matches, or for showing the number
+    of the current match, while the text is being edited.
+
+    The @c indexed signal is sent from the thread running the #main_loop function, by means of the
+    #signal_update mechanism, when the matches from the background thread have been taken over.
+    If the finder_t can not be cloned, all matches are located by the constructor instead.
+
+    Matches are found in the same way as repeated forward searches do, i.e. the next match is
+    searched for from the end of the previous match. Matches are ordered by their start position.
+    They are stored per line, such that a change only costs time for the changed lines and not
+    for the matches in the rest of the text.
+*/
+class T3_WIDGET_API match_index_t {
+ private:
+  struct T3_WIDGET_LOCAL implementation_t;
+  pimpl_t<implementation_t> impl;
+
+ public:
+  /** Create a new match_index_t.
+      @param text The text_buffer_t to index. It must remain valid while the match_index_t exists.
+      @param finder The finder_t used to locate the matches. Copies are made using
+          finder_t::clone, so @p finder does not have to remain valid. If finder_t::clone returns
+          @c nullptr, @p finder is used directly, and must remain valid while the match_index_t
+          exists.
+  */
+  match_index_t(text_buffer_t *text, finder_t *finder);
+  /** Destroy the match_index_t, cancelling the background search if it is still running. */
+  ~match_index_t();
+
+  /** Returns whether all matches have been located. */
+  bool is_complete() const;
+  /** Retrieve the total number of matches. */
+  size_t size() const;
+  /** Retrieve match number @p idx. */
+  find_result_t get_match(size_t idx) const;
+  /** Retrieve the index of the first match that starts at or after @p pos.
+      If there is no such match, size() is returned. This can be used both to find the matches
+      on a range of lines, and to find the number of the match at the cursor. */
+  size_t find_match(text_coordinate_t pos) const;
+
+  T3_WIDGET_DECLARE_SIGNAL(indexed);
+};
+
+}  // namespace t3widget
+#endif
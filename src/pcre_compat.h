@@ -39,8 +39,13 @@
 #define PCRE2_CASELESS PCRE_CASELESS
 #define PCRE2_NOTEOL PCRE_NOTEOL
 #define PCRE2_NOTBOL PCRE_NOTBOL
+#define PCRE2_MULTILINE PCRE_MULTILINE
+#define PCRE2_NOTEMPTY_ATSTART PCRE_NOTEMPTY_ATSTART
+#define PCRE2_PARTIAL_HARD PCRE_PARTIAL_HARD
+#define PCRE2_UNSET (-1)
 
 #define PCRE2_ERROR_BADOPTION PCRE_ERROR_BADOPTION
+#define PCRE2_ERROR_PARTIAL PCRE_ERROR_PARTIAL
 
 typedef struct {
   pcre *regex;
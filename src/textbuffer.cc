@@ -12,6 +12,8 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <ext/alloc_traits.h>
 #include <limits>
@@ -46,7 +48,10 @@ text_buffer_t::~text_buffer_t() {}
 text_pos_t text_buffer_t::size() const { return impl->size(); }
 
 const text_line_t &text_buffer_t::get_line_data(text_pos_t idx) const { return *impl->lines[idx]; }
-text_line_t *text_buffer_t::get_mutable_line_data(text_pos_t idx) { return impl->lines[idx].get(); }
+text_line_t *text_buffer_t::get_mutable_line_data(text_pos_t idx) {
+  impl->prepare_change();
+  return impl->lines[idx].get();
+}
 
 text_line_factory_t *text_buffer_t::get_line_factory() { return impl->line_factory; }
 
@@ -66,6 +71,8 @@ bool text_buffer_t::merge(bool backspace) { return impl->merge(backspace); }
 
 bool text_buffer_t::append_text(string_view text) { return impl->append_text(text); }
 
+int text_buffer_t::load_file(const std::string &name) { return impl->load_file(name); }
+
 bool text_buffer_t::break_line(const std::string &indent) { return impl->break_line(indent); }
 
 text_pos_t text_buffer_t::calculate_screen_pos(int tabsize) const {
@@ -134,6 +141,14 @@ std::unique_ptr<std::string> text_buffer_t::convert_block(text_coordinate_t star
 
 void text_buffer_t::set_undo_mark() { impl->set_undo_mark(); }
 
+int text_buffer_t::open_undo_journal(const std::string &name) {
+  return impl->undo_list.open_journal(name, impl->lines.hash());
+}
+
+void text_buffer_t::set_undo_memory_limit(size_t limit, bool spill) {
+  impl->undo_list.set_memory_limit(limit, spill);
+}
+
 /*FIXME: define return values for:
         - nothing done
         - failure
@@ -179,6 +194,11 @@ void text_buffer_t::replace(const finder_t &finder, const find_result_t &result)
   replace_block(result.start, result.end, replacement_str);
 }
 
+text_pos_t text_buffer_t::replace_all(finder_t *finder, text_coordinate_t start,
+                                      text_coordinate_t &end) {
+  return impl->replace_all(finder, start, end);
+}
+
 void text_buffer_t::set_selection_mode(selection_mode_t mode) {
   return impl->set_selection_mode(mode);
 }
@@ -220,6 +240,33 @@ _T3_WIDGET_IMPL_SIGNAL(text_buffer_t, rewrap_required, rewrap_type_t, text_pos_t
 
 //==================================== implementation_t ============================================
 
+/* Primary selection referring to a range of the text. The text is only copied when it is
+   requested, or when the text is about to change. */
+class text_buffer_t::implementation_t::primary_selection_t : public selection_provider_t {
+ public:
+  primary_selection_t(implementation_t *_buffer, text_coordinate_t _start, text_coordinate_t _end)
+      : buffer(_buffer), start(_start), end(_end) {}
+
+  std::unique_ptr<std::string> get_text() override {
+    snapshot();
+    return std::move(text);
+  }
+
+  void snapshot() {
+    if (buffer != nullptr) {
+      text = buffer->convert_block(start, end);
+      buffer = nullptr;
+    }
+  }
+
+ private:
+  implementation_t *buffer;
+  text_coordinate_t start, end;
+  std::unique_ptr<std::string> text;
+};
+
+text_buffer_t::implementation_t::~implementation_t() { snapshot_primary(); }
+
 text_pos_t text_buffer_t::implementation_t::calculate_line_pos(text_pos_t line, text_pos_t pos,
                                                                int tabsize) const {
   return lines[line]->calculate_line_pos(0, std::numeric_limits<text_pos_t>::max(), pos, tabsize);
@@ -299,7 +346,7 @@ bool text_buffer_t::implementation_t::merge_internal(text_pos_t line) {
   cursor.line = line;
   cursor.pos = lines[line]->size();
   lines[line]->merge(std::move(lines[line + 1]));
-  lines.erase(lines.begin() + line + 1);
+  lines.erase(line + 1, line + 2);
   rewrap_required(rewrap_type_t::DELETE_LINES, line + 1, line + 2);
   rewrap_required(rewrap_type_t::REWRAP_LINE, cursor.line, cursor.pos);
   return true;
@@ -317,10 +364,15 @@ bool text_buffer_t::implementation_t::insert_block_internal(text_coordinate_t in
   lines[insert_at.line]->merge(block->break_on_nl(&next_start));
   rewrap_required(rewrap_type_t::REWRAP_LINE, insert_at.line, insert_at.pos);
 
+  /* Signal the insertion of all new lines at once, such that listeners can
+     process the whole range in one go. */
+  text_pos_t first_inserted = insert_at.line + 1;
   while (next_start > 0) {
     insert_at.line++;
-    lines.insert(lines.begin() + insert_at.line, block->break_on_nl(&next_start));
-    rewrap_required(rewrap_type_t::INSERT_LINES, insert_at.line, insert_at.line + 1);
+    lines.insert(insert_at.line, block->break_on_nl(&next_start));
+  }
+  if (insert_at.line >= first_inserted) {
+    rewrap_required(rewrap_type_t::INSERT_LINES, first_inserted, insert_at.line + 1);
   }
 
   cursor.pos = lines[insert_at.line]->size();
@@ -429,19 +481,19 @@ void text_buffer_t::implementation_t::delete_block_internal(text_coordinate_t st
     }
   }
   end.line++;
-  lines.erase(lines.begin() + start.line, lines.begin() + end.line);
+  lines.erase(start.line, end.line);
   cursor.pos = lines[cursor.line]->adjust_position(cursor.pos, 0);
 
   rewrap_required(rewrap_type_t::DELETE_LINES, start.line, end.line);
   rewrap_required(rewrap_type_t::REWRAP_LINE, start.line - 1, start.pos);
-  if (static_cast<size_t>(start.line) < lines.size()) {
+  if (start.line < lines.size()) {
     rewrap_required(rewrap_type_t::REWRAP_LINE, start.line, 0);
   }
 }
 
 bool text_buffer_t::implementation_t::break_line_internal(const std::string &indent) {
   std::unique_ptr<text_line_t> insert = lines[cursor.line]->break_line(cursor.pos);
-  lines.insert(lines.begin() + cursor.line + 1, std::move(insert));
+  lines.insert(cursor.line + 1, std::move(insert));
   rewrap_required(rewrap_type_t::REWRAP_LINE, cursor.line, cursor.pos);
   rewrap_required(rewrap_type_t::INSERT_LINES, cursor.line + 1, cursor.line + 2);
   cursor.line++;
@@ -470,11 +522,26 @@ bool text_buffer_t::implementation_t::merge(bool backspace) {
 
 bool text_buffer_t::implementation_t::append_text(string_view text) {
   bool result;
+  prepare_change();
   text_coordinate_t at(lines.size() - 1, std::numeric_limits<text_pos_t>::max());
   result = insert_block_internal(at, line_factory->new_text_line_t(text));
   return result;
 }
 
+int text_buffer_t::implementation_t::load_file(const std::string &name) {
+  ASSERT(lines.size() == 1 && lines[0]->size() == 0);
+  prepare_change();
+  int error = lines.load_file(name, line_factory);
+  if (error != 0) {
+    return error;
+  }
+
+  cursor = text_coordinate_t(0, 0);
+  rewrap_required(rewrap_type_t::DELETE_LINES, 0, 1);
+  rewrap_required(rewrap_type_t::INSERT_LINES, 0, lines.size());
+  return 0;
+}
+
 bool text_buffer_t::implementation_t::break_line(const std::string &indent) {
   start_undo_block();
   undo_t *undo = get_undo(UNDO_ADD);
@@ -574,7 +641,7 @@ void text_buffer_t::implementation_t::goto_next_word() {
     cursor.pos = -1;
     /* Keep skipping to next line if no word can be found */
     while (cursor.pos < 0) {
-      if (static_cast<size_t>(cursor.line) + 1 >= lines.size()) {
+      if (cursor.line + 1 >= lines.size()) {
         break;
       }
       line = lines[++cursor.line].get();
@@ -646,8 +713,32 @@ void text_buffer_t::implementation_t::set_selection_mode(selection_mode_t mode)
 void text_buffer_t::implementation_t::set_selection_end(bool update_primary) {
   selection_end = cursor;
   if (update_primary) {
-    set_primary(convert_block(selection_start, selection_end));
+    publish_primary();
+  }
+}
+
+void text_buffer_t::implementation_t::publish_primary() {
+  if (selection_start == selection_end) {
+    set_primary(nullptr);
+    return;
+  }
+  std::shared_ptr<primary_selection_t> selection =
+      std::make_shared<primary_selection_t>(this, selection_start, selection_end);
+  primary_selection = selection;
+  set_primary_provider(std::move(selection));
+}
+
+uint64_t text_buffer_t::implementation_t::new_version() {
+  static std::atomic<uint64_t> next_version(0);
+  return next_version++;
+}
+
+void text_buffer_t::implementation_t::snapshot_primary() {
+  std::shared_ptr<primary_selection_t> selection = primary_selection.lock();
+  if (selection != nullptr) {
+    selection->snapshot();
   }
+  primary_selection.reset();
 }
 
 undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type) {
@@ -655,15 +746,14 @@ undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type) {
 }
 
 undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type, text_coordinate_t coord) {
+  /* All changes to the text are recorded in the undo list, so this is the point to prepare for
+     the change. */
+  prepare_change();
   if (last_undo_type == type && last_undo_position.line == coord.line &&
       last_undo_position.pos == coord.pos && last_undo != nullptr) {
     return last_undo;
   }
 
-  if (last_undo != nullptr) {
-    last_undo->minimize();
-  }
-
   ASSERT(type != UNDO_NONE && type <= UNDO_BLOCK_END);
   last_undo_position = coord;
 
@@ -683,10 +773,7 @@ undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type, text_coordin
 }
 
 void text_buffer_t::implementation_t::set_undo_mark() {
-  undo_list.set_mark();
-  if (last_undo != nullptr) {
-    last_undo->minimize();
-  }
+  undo_list.set_mark(undo_list.is_journaled() ? lines.hash() : 0);
   last_undo_type = UNDO_NONE;
 }
 
@@ -696,17 +783,18 @@ void text_buffer_t::implementation_t::set_undo_mark() {
 void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *current) {
   text_coordinate_t start, end;
 
+  prepare_change();
   set_selection_mode(selection_mode_t::NONE);
   switch (type) {
     case UNDO_ADD: {
       end = start = current->get_start();
-      size_t newline = current->get_text()->find_last_of('\n');
+      string_view text = current->get_text_view();
+      size_t newline = text.find_last_of('\n');
       if (newline == std::string::npos) {
-        end.pos += current->get_text()->size();
+        end.pos += text.size();
       } else {
-        end.pos = current->get_text()->size() - newline - 1;
-        tiny_string_t::iterator begin = current->get_text()->begin();
-        end.line += std::count(begin, begin + newline, '\n') + 1;
+        end.pos = text.size() - newline - 1;
+        end.line += std::count(text.begin(), text.begin() + newline, '\n') + 1;
       }
       delete_block_internal(start, end, nullptr);
       break;
@@ -714,28 +802,28 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
     case UNDO_ADD_REDO:
     case UNDO_DELETE:
       start = current->get_start();
-      insert_block_internal(start, line_factory->new_text_line_t(*current->get_text()));
+      insert_block_internal(start, line_factory->new_text_line_t(current->get_text_view()));
       if (type == UNDO_DELETE) {
         cursor = start;
       }
       break;
     case UNDO_BACKSPACE_WORD:
       start = current->get_start();
-      start.pos -= current->get_text()->size();
-      insert_block_internal(start, line_factory->new_text_line_t(*current->get_text()));
+      start.pos -= current->get_text_view().size();
+      insert_block_internal(start, line_factory->new_text_line_t(current->get_text_view()));
       break;
     case UNDO_BACKSPACE:
       start = current->get_start();
-      start.pos -= current->get_text()->size();
-      insert_block_internal(start, line_factory->new_text_line_t(*current->get_text()));
+      start.pos -= current->get_text_view().size();
+      insert_block_internal(start, line_factory->new_text_line_t(current->get_text_view()));
       break;
     case UNDO_BACKSPACE_REDO:
       end = start = current->get_start();
-      start.pos -= current->get_text()->size();
+      start.pos -= current->get_text_view().size();
       delete_block_internal(start, end, nullptr);
       break;
     case UNDO_OVERWRITE: {
-      double_string_adapter_t undo_adapter(current->get_text());
+      double_string_view_t undo_adapter(current->get_text_view());
       end = start = current->get_start();
       end.pos += undo_adapter.second().size();
       delete_block_internal(start, end, nullptr);
@@ -744,7 +832,7 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
       break;
     }
     case UNDO_OVERWRITE_REDO: {
-      double_string_adapter_t undo_adapter(current->get_text());
+      double_string_view_t undo_adapter(current->get_text_view());
       end = start = current->get_start();
       end.pos += undo_adapter.first().size();
       delete_block_internal(start, end, nullptr);
@@ -760,18 +848,24 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
       cursor = current->get_start();
       break;
     case UNDO_BLOCK_END:
+      /* Blocks are only discarded as a whole, but an unmatched block end may still reach the
+         oldest record. Undoing then simply stops there. */
       do {
         current = undo_list.back();
+        if (current == nullptr) {
+          break;
+        }
         apply_undo_redo(current->get_type(), current);
-      } while (current != nullptr && current->get_type() != UNDO_BLOCK_START);
-      ASSERT(current != nullptr);
+      } while (current->get_type() != UNDO_BLOCK_START);
       break;
     case UNDO_BLOCK_START_REDO:
       do {
         current = undo_list.forward();
+        if (current == nullptr) {
+          break;
+        }
         apply_undo_redo(current->get_redo_type(), current);
-      } while (current != nullptr && current->get_redo_type() != UNDO_BLOCK_END_REDO);
-      ASSERT(current != nullptr);
+      } while (current->get_redo_type() != UNDO_BLOCK_END_REDO);
       break;
     default:
       ASSERT(false);
@@ -787,7 +881,14 @@ void text_buffer_t::implementation_t::set_selection_from_find(const find_result_
 
   cursor = selection_end;
   selection_mode = selection_mode_t::SHIFT;
-  set_primary(convert_block(selection_start, selection_end));
+  publish_primary();
+}
+
+/* Only regular expressions can match across lines. For other searches the MULTILINE flag is
+   ignored, and lines are searched one at a time. */
+static bool is_multiline_search(const finder_t *finder) {
+  int flags = finder->get_flags();
+  return (flags & find_flags_t::MULTILINE) && (flags & find_flags_t::REGEX);
 }
 
 bool text_buffer_t::implementation_t::find(finder_t *finder, find_result_t *result,
@@ -798,6 +899,10 @@ bool text_buffer_t::implementation_t::find(finder_t *finder, find_result_t *resu
      search has started. The finder->match function does not take those values into
      account. */
 
+  if (is_multiline_search(finder)) {
+    return find_multiline(finder, result, reverse);
+  }
+
   // Perform search
   if (((finder->get_flags() & find_flags_t::BACKWARD) != 0) ^ reverse) {
     start = idx = result->start.line;
@@ -838,8 +943,8 @@ bool text_buffer_t::implementation_t::find(finder_t *finder, find_result_t *resu
     }
 
     result->start.pos = -1;
-    const size_t lines_size = lines.size();
-    for (idx++; idx < static_cast<text_pos_t>(lines_size); idx++) {
+    const text_pos_t lines_size = lines.size();
+    for (idx++; idx < lines_size; idx++) {
       if (finder->match(lines[idx]->get_data(), result, false)) {
         result->start.line = result->end.line = idx;
         return true;
@@ -866,12 +971,22 @@ bool text_buffer_t::implementation_t::find_limited(finder_t *finder, text_coordi
                                                    find_result_t *result) const {
   text_pos_t idx;
 
+  if (is_multiline_search(finder)) {
+    if (end.line >= lines.size()) {
+      end.line = lines.size() - 1;
+      end.pos = lines[end.line]->size();
+    }
+    bool not_empty_at_start = start.pos >= 0;
+    start.pos = std::max<text_pos_t>(start.pos, 0);
+    return next_multiline_match(finder, start, not_empty_at_start, end, end.line, result);
+  }
+
   /* Note: the finder->match function does not take value of result->start.line
      and result->end.line into account. */
   result->start = start;
   result->end.pos = -1;
 
-  for (idx = start.line; static_cast<size_t>(idx) < lines.size() && idx < end.line; idx++) {
+  for (idx = start.line; idx < lines.size() && idx < end.line; idx++) {
     if (finder->match(lines[idx]->get_data(), result, false)) {
       result->start.line = result->end.line = idx;
       return true;
@@ -880,8 +995,7 @@ bool text_buffer_t::implementation_t::find_limited(finder_t *finder, text_coordi
   }
 
   result->end = end;
-  if (static_cast<size_t>(idx) < lines.size() &&
-      finder->match(lines[idx]->get_data(), result, false)) {
+  if (idx < lines.size() && finder->match(lines[idx]->get_data(), result, false)) {
     result->start.line = result->end.line = idx;
     return true;
   }
@@ -889,6 +1003,322 @@ bool text_buffer_t::implementation_t::find_limited(finder_t *finder, text_coordi
   return false;
 }
 
+/* The double_string_adapter_t used for UNDO_OVERWRITE records stores the size of the first string
+   as a single UTF-8 encoded character, which limits the size of the replaced text. */
+static const size_t max_overwrite_undo_size = 0x10ffff;
+
+namespace {
+struct replacement_t {
+  text_pos_t start, end;
+  std::string text;
+};
+}  // namespace
+
+text_pos_t text_buffer_t::implementation_t::replace_all(finder_t *finder, text_coordinate_t start,
+                                                       text_coordinate_t &end) {
+  if (end.line >= lines.size()) {
+    end.line = lines.size() - 1;
+    end.pos = lines[end.line]->size();
+  }
+
+  if (is_multiline_search(finder)) {
+    return replace_each(finder, start, end);
+  }
+
+  std::vector<replacement_t> replacements;
+  std::string new_data;
+  find_result_t match;
+  text_pos_t count = 0;
+  /* Contiguous range of lines changed in place, for which the rewrap_required notification is
+     pending. */
+  text_pos_t first_changed = 0;
+  text_pos_t last_changed = -1;
+  text_coordinate_t last_replacement(-1, 0);
+
+  /* The lines are handled from the last to the first. Replacements containing a newline are
+     made using replace_block, which changes the number of lines. Working backwards ensures that
+     this does not affect the line numbers of the lines still to be searched. */
+  for (text_pos_t line = end.line; line >= start.line && line >= 0; --line) {
+    const std::string &data = lines[line]->get_data();
+    const text_pos_t limit =
+        line == end.line ? std::min<text_pos_t>(end.pos, data.size()) : data.size();
+    bool needs_replace_block = false;
+
+    replacements.clear();
+    match.start.pos = line == start.line ? start.pos : -1;
+    match.end.pos = line == end.line ? end.pos : -1;
+    while (finder->match(data, &match, false)) {
+      replacements.push_back(replacement_t{match.start.pos, match.end.pos,
+                                           finder->get_replacement(data)});
+      needs_replace_block |= replacements.back().text.find('\n') != std::string::npos;
+      if (match.end.pos >= limit) {
+        break;
+      }
+      /* Searching from the end of the previous match excludes empty matches at that point, as
+         find_limited does when continuing from the cursor. */
+      match.start.pos = match.end.pos;
+      match.end.pos = line == end.line ? end.pos : -1;
+    }
+    if (replacements.empty()) {
+      continue;
+    }
+
+    if (count == 0) {
+      start_undo_block();
+    }
+    count += replacements.size();
+
+    const text_pos_t span_start = replacements.front().start;
+    const text_pos_t span_end = replacements.back().end;
+    if (needs_replace_block ||
+        static_cast<size_t>(span_end - span_start) > max_overwrite_undo_size) {
+      if (last_changed >= first_changed) {
+        rewrap_required(rewrap_type_t::REWRAP_LINES, first_changed, last_changed + 1);
+        last_changed = -1;
+      }
+      const text_pos_t lines_before = lines.size();
+      const text_pos_t line_size_before = lines[line]->size();
+      for (auto iter = replacements.rbegin(); iter != replacements.rend(); ++iter) {
+        replace_block(text_coordinate_t(line, iter->start), text_coordinate_t(line, iter->end),
+                      iter->text);
+      }
+      /* The text after the last replacement ends up at the end of the last line. */
+      const text_pos_t added_lines = lines.size() - lines_before;
+      const text_pos_t last_line = line + added_lines;
+      if (line == end.line) {
+        end.pos += lines[last_line]->size() - line_size_before;
+      }
+      end.line += added_lines;
+      if (last_replacement.line < 0) {
+        last_replacement.line = last_line;
+        last_replacement.pos = lines[last_line]->size() - (line_size_before - span_end);
+      } else {
+        last_replacement.line += added_lines;
+      }
+      continue;
+    }
+
+    new_data.clear();
+    text_pos_t copied = span_start;
+    for (const replacement_t &replacement : replacements) {
+      new_data.append(data, copied, replacement.start - copied);
+      new_data += replacement.text;
+      copied = replacement.end;
+    }
+
+    undo_t *undo = get_undo(UNDO_OVERWRITE, text_coordinate_t(line, span_start));
+    double_string_adapter_t undo_adapter(undo->get_text());
+    undo_adapter.append_first(string_view(data.data() + span_start, span_end - span_start));
+    undo_adapter.append_second(new_data);
+
+    const text_pos_t size_change = new_data.size() - (span_end - span_start);
+    if (line == end.line) {
+      end.pos += size_change;
+    }
+    if (last_replacement.line < 0) {
+      last_replacement = text_coordinate_t(line, span_end + size_change);
+    }
+
+    new_data.insert(0, data, 0, span_start);
+    new_data.append(data, span_end, std::string::npos);
+    lines[line]->set_text(new_data);
+
+    /* Lines without matches are not rewrapped, so a range ends at a skipped line. */
+    if (last_changed >= first_changed && line + 1 != first_changed) {
+      rewrap_required(rewrap_type_t::REWRAP_LINES, first_changed, last_changed + 1);
+      last_changed = -1;
+    }
+    if (last_changed < first_changed) {
+      last_changed = line;
+    }
+    first_changed = line;
+  }
+
+  if (count == 0) {
+    return 0;
+  }
+  if (last_changed >= first_changed) {
+    rewrap_required(rewrap_type_t::REWRAP_LINES, first_changed, last_changed + 1);
+  }
+  cursor = last_replacement;
+  end_undo_block();
+  return count;
+}
+
+/* Replaces the matches one at a time, for searches where matches may span multiple lines. */
+text_pos_t text_buffer_t::implementation_t::replace_each(finder_t *finder, text_coordinate_t start,
+                                                        text_coordinate_t &end) {
+  find_result_t result;
+  text_pos_t count = 0;
+
+  while (find_limited(finder, start, end, &result)) {
+    if (count == 0) {
+      start_undo_block();
+    }
+    const text_pos_t lines_before = lines.size();
+    const text_pos_t end_line_size = lines[end.line]->size();
+    replace_block(result.start, result.end,
+                  finder->get_replacement(lines[result.start.line]->get_data()));
+    start = cursor;
+    /* The end of the range is on the last line changed by the replacement, or after it. */
+    end.line += lines.size() - lines_before;
+    if (end.line == cursor.line) {
+      end.pos += lines[end.line]->size() - end_line_size;
+    }
+    ++count;
+  }
+  if (count != 0) {
+    end_undo_block();
+  }
+  return count;
+}
+
+bool text_buffer_t::implementation_t::find_multiline(finder_t *finder, find_result_t *result,
+                                                     bool reverse) const {
+  const text_coordinate_t eof(lines.size() - 1, lines[lines.size() - 1]->size());
+
+  if (((finder->get_flags() & find_flags_t::BACKWARD) != 0) ^ reverse) {
+    const text_coordinate_t start = result->start;
+    if (last_multiline_match(finder, start, true, result)) {
+      return true;
+    }
+    return (finder->get_flags() & find_flags_t::WRAP) &&
+           last_multiline_match(finder, eof, false, result);
+  }
+
+  const text_coordinate_t start = cursor;
+  if (next_multiline_match(finder, start, true, eof, eof.line, result)) {
+    return true;
+  }
+  return (finder->get_flags() & find_flags_t::WRAP) &&
+         next_multiline_match(finder, text_coordinate_t(0, 0), false, eof, start.line, result);
+}
+
+/* Initial size of the window of text passed to finder_t::match_window. The window is only
+   enlarged while a match is in progress at its end, so for most regular expressions the buffer
+   is never copied as a whole. */
+static const size_t multiline_window_size = 65536;
+
+/* Searches for the first match starting at or after from, and in line last_start_line or
+   before. The text after limit is not considered. */
+bool text_buffer_t::implementation_t::next_multiline_match(finder_t *finder, text_coordinate_t from,
+                                                           bool not_empty_at_start,
+                                                           text_coordinate_t limit,
+                                                           text_pos_t last_start_line,
+                                                           find_result_t *result) const {
+  std::string window;
+  /* The offset in window of the start of each line in it. */
+  std::vector<size_t> line_offsets;
+  size_t window_size = multiline_window_size;
+
+  /* Windows always start at the start of a line, such that the start of the window is a valid
+     place for ^ to match. */
+  text_pos_t first_line = from.line;
+  size_t start = from.pos;
+
+  while (first_line <= last_start_line && text_coordinate_t(first_line, start) <= limit) {
+    window.clear();
+    line_offsets.clear();
+    text_pos_t line;
+    for (line = first_line;
+         line <= limit.line && (line == first_line || window.size() < window_size); ++line) {
+      line_offsets.push_back(window.size());
+      const std::string &data = lines[line]->get_data();
+      if (line == limit.line) {
+        window.append(data, 0, limit.pos);
+      } else {
+        window += data;
+        window += '\n';
+      }
+    }
+    const bool at_end = line > limit.line;
+    const bool not_eol = at_end && limit.pos < lines[limit.line]->size();
+
+    size_t match_start, match_end;
+    switch (finder->match_window(window, start, at_end, not_eol, not_empty_at_start, &match_start,
+                                 &match_end)) {
+      case finder_t::window_match_t::MATCH: {
+        size_t idx = std::upper_bound(line_offsets.begin(), line_offsets.end(), match_start) -
+                     line_offsets.begin() - 1;
+        result->start.line = first_line + idx;
+        result->start.pos = match_start - line_offsets[idx];
+        if (result->start.line > last_start_line) {
+          return false;
+        }
+        idx = std::upper_bound(line_offsets.begin(), line_offsets.end(), match_end) -
+              line_offsets.begin() - 1;
+        result->end.line = first_line + idx;
+        result->end.pos = match_end - line_offsets[idx];
+        /* A match ending right after the newline of the last line in the window ends at the start
+           of the next line. */
+        if (result->end.pos > lines[result->end.line]->size()) {
+          result->end.line++;
+          result->end.pos = 0;
+        }
+        return true;
+      }
+      case finder_t::window_match_t::NO_MATCH:
+        if (at_end) {
+          return false;
+        }
+        first_line = line;
+        start = 0;
+        not_empty_at_start = false;
+        window_size = multiline_window_size;
+        break;
+      case finder_t::window_match_t::PARTIAL: {
+        /* Restart the search at the line holding the start of the partial match, with a window
+           that holds at least twice as much text after it. */
+        size_t idx = std::upper_bound(line_offsets.begin(), line_offsets.end(), match_start) -
+                     line_offsets.begin() - 1;
+        if (idx != 0 || match_start != start) {
+          not_empty_at_start = false;
+        }
+        window_size = std::max(window_size, 2 * (window.size() - line_offsets[idx]));
+        first_line += idx;
+        start = match_start - line_offsets[idx];
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+/* Searches for the last match ending at or before limit. As matches are found by searching
+   forward, the text is searched in blocks of increasing size, starting at limit. */
+bool text_buffer_t::implementation_t::last_multiline_match(finder_t *finder,
+                                                           text_coordinate_t limit,
+                                                           bool not_empty_at_end,
+                                                           find_result_t *result) const {
+  text_pos_t block_end = limit.line + 1;
+  text_pos_t block_lines = 64;
+
+  while (block_end > 0) {
+    const text_pos_t block_start = std::max<text_pos_t>(0, block_end - block_lines);
+    text_coordinate_t from(block_start, 0);
+    bool not_empty_at_start = false;
+    bool found = false;
+    find_result_t match;
+
+    while (next_multiline_match(finder, from, not_empty_at_start, limit, block_end - 1, &match)) {
+      if (!not_empty_at_end || match.start != limit) {
+        *result = match;
+        found = true;
+      }
+      /* After an empty match, only a non-empty match may start at the same position, to ensure
+         progress. */
+      from = match.end;
+      not_empty_at_start = match.start == match.end;
+    }
+    if (found) {
+      return true;
+    }
+    block_end = block_start;
+    block_lines *= 2;
+  }
+  return false;
+}
+
 bool text_buffer_t::implementation_t::indent_block(text_coordinate_t &start, text_coordinate_t &end,
                                                    int tabsize, bool tab_spaces) {
   text_pos_t end_line;
@@ -953,13 +1383,13 @@ bool text_buffer_t::implementation_t::undo_indent_selection(undo_t *undo, undo_t
 
   first_line = undo->get_start().line;
 
-  tiny_string_t *undo_text = undo->get_text();
+  string_view undo_text = undo->get_text_view();
   bool last = false;
   for (; !last; first_line++) {
-    next_pos = undo_text->find('X', pos);
+    next_pos = undo_text.find('X', pos);
 
     if (next_pos == std::string::npos) {
-      next_pos = undo_text->size();
+      next_pos = undo_text.size();
       last = true;
     }
 
@@ -973,7 +1403,7 @@ bool text_buffer_t::implementation_t::undo_indent_selection(undo_t *undo, undo_t
       text_coordinate_t insert_at(first_line, 0);
       if (next_pos != pos) {
         insert_block_internal(insert_at, line_factory->new_text_line_t(
-                                             string_view(undo_text->data() + pos, next_pos - pos)));
+                                             undo_text.substr(pos, next_pos - pos)));
       }
     }
     pos = next_pos + 1;
@@ -26,9 +26,13 @@ namespace t3widget {
 
 struct find_result_t;
 class finder_t;
+class async_find_t;
+class match_index_t;
 class wrap_info_t;
 
 class T3_WIDGET_API text_buffer_t {
+  friend class async_find_t;
+  friend class match_index_t;
   friend class wrap_info_t;
 
  private:
@@ -62,7 +66,24 @@ class T3_WIDGET_API text_buffer_t {
   bool break_line(const std::string &indent = "");
   bool insert_block(const std::string &block);
 
+  /** Append text to the end of the buffer.
+
+      All lines in @p text are added before any listeners are notified, so
+      appending many lines in a single call is much cheaper than appending them
+      one at a time.
+  */
   bool append_text(string_view text);
+  /** Load the contents of a file into the buffer.
+      @param name The name of the file to load.
+      @return 0 on success, or an @c errno value on failure.
+
+      The file is mapped into memory, and lines are only converted into
+      text_line_t objects when they are accessed. This makes loading large files
+      for viewing fast. This function should only be called on a newly created
+      text_buffer_t, and the file should not be truncated while the buffer
+      exists.
+  */
+  int load_file(const std::string &name);
 
   text_pos_t get_line_size(text_pos_t line) const;
   void adjust_position(int adjust);
@@ -105,11 +126,47 @@ class T3_WIDGET_API text_buffer_t {
   bool find_limited(finder_t *finder, text_coordinate_t start, text_coordinate_t end,
                     find_result_t *result) const;
   void replace(const finder_t &finder, const find_result_t &result);
+  /** Replace all matches in a range of the text.
+      @param finder The ::finder_t used to locate the matches.
+      @param start The start of the range. As for #find_limited, a negative @c pos allows an empty
+          match at the start of the line.
+      @param end The end of the range. On return, it is updated to refer to the same location in the
+          changed text.
+      @return The number of replacements made.
+
+      The result is the same as that of calling #find_limited and #replace until no more matches
+      are found, but each line is changed only once. A single undo record is created for every
+      changed line, and all changes are undone as a single operation. Unless a replacement
+      contains a newline, the changed lines are reported through one @c rewrap_required
+      notification of type rewrap_type_t::REWRAP_LINES for each run of consecutive changed lines,
+      rather than a single notification for all of them. That way, lines without matches in
+      between are not rewrapped or searched again by the listeners. The cursor is placed after the
+      last replacement.
+  */
+  text_pos_t replace_all(finder_t *finder, text_coordinate_t start, text_coordinate_t &end);
 
   bool is_modified() const;
   std::unique_ptr<std::string> convert_block(text_coordinate_t start, text_coordinate_t end);
   int apply_undo();
   int apply_redo();
+  /** Limit the memory used by the undo history.
+      @param limit The number of bytes the undo history may use, or 0 for no limit (the default).
+      @param spill Whether to move old undo history to a temporary file instead of discarding it.
+
+      When the limit is exceeded, old undo steps for consecutive typing or deleting are merged
+      first, after which old history is moved to a temporary file (if @p spill is @c true) or
+      discarded. */
+  void set_undo_memory_limit(size_t limit, bool spill = false);
+  /** Write the undo history to a journal file, and restore it from there if possible.
+      @param name The name of the journal file.
+      @return 0 on success, or an @c errno value on failure.
+
+      This should be called directly after #load_file. If the journal was written for the same
+      file, and the text is the same as when the file was last saved with the journal open, the
+      undo history is restored. Changes made after that save can then be redone. The journal is
+      written by a background thread, so editing does not wait for the file system.
+  */
+  int open_undo_journal(const std::string &name);
   void start_undo_block();
   void end_undo_block();
 
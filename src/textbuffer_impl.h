@@ -18,13 +18,16 @@
 #error This header file is for internal use _only_!!
 #endif
 
+#include <cstdint>
+#include <memory>
+#include <t3widget/linestore.h>
 #include <t3widget/textbuffer.h>
 #include <t3widget/undo.h>
 
 namespace t3widget {
 
 struct text_buffer_t::implementation_t {
-  std::vector<std::unique_ptr<text_line_t>> lines;
+  line_store_t lines;
   text_coordinate_t selection_start;
   text_coordinate_t selection_end;
   selection_mode_t selection_mode;
@@ -38,6 +41,15 @@ struct text_buffer_t::implementation_t {
   signal_t<rewrap_type_t, text_pos_t, text_pos_t> rewrap_required;
   text_coordinate_t cursor;
 
+  /* Identifies the current state of the text. Every change to the text assigns a new value,
+     which is unique among all text_buffer_t objects, such that a copy of the text can be reused
+     as long as this value is unchanged. */
+  uint64_t version;
+
+  class primary_selection_t;
+  /* The primary selection published by this buffer, if it still refers to the text. */
+  std::weak_ptr<primary_selection_t> primary_selection;
+
   implementation_t(text_line_factory_t *_line_factory)
       : selection_start(-1, 0),
         selection_end(-1, 0),
@@ -45,10 +57,12 @@ struct text_buffer_t::implementation_t {
         last_undo_type(UNDO_NONE),
         last_undo(nullptr),
         line_factory(_line_factory == nullptr ? &default_text_line_factory : _line_factory),
-        cursor(0, 0) {
+        cursor(0, 0),
+        version(new_version()) {
     // Allocate a new, empty line
     lines.push_back(line_factory->new_text_line_t());
   }
+  ~implementation_t();
 
   text_pos_t size() const { return lines.size(); }
   text_pos_t get_line_size(text_pos_t line) const { return lines[line]->size(); }
@@ -63,11 +77,22 @@ struct text_buffer_t::implementation_t {
   void delete_block_internal(text_coordinate_t start, text_coordinate_t end, undo_t *undo);
   bool break_line_internal(const std::string &indent = nullptr);
   bool append_text(string_view text);
+  int load_file(const std::string &name);
   bool break_line(const std::string &indent);
   bool merge(bool backspace);
   bool insert_block(const std::string &block);
   bool replace_block(text_coordinate_t start, text_coordinate_t end, const std::string &block);
   std::unique_ptr<std::string> convert_block(text_coordinate_t start, text_coordinate_t end);
+  /* Set the primary selection to the selected text, without copying the text. */
+  void publish_primary();
+  /* Copy the text of the published primary selection. */
+  void snapshot_primary();
+  /* Must be called before changing the text. */
+  void prepare_change() {
+    version = new_version();
+    snapshot_primary();
+  }
+  static uint64_t new_version();
   void goto_next_word();
   void goto_previous_word();
   void goto_next_word_boundary();
@@ -87,6 +112,14 @@ struct text_buffer_t::implementation_t {
   bool find(finder_t *finder, find_result_t *result, bool reverse) const;
   bool find_limited(finder_t *finder, text_coordinate_t start, text_coordinate_t end,
                     find_result_t *result) const;
+  text_pos_t replace_all(finder_t *finder, text_coordinate_t start, text_coordinate_t &end);
+  text_pos_t replace_each(finder_t *finder, text_coordinate_t start, text_coordinate_t &end);
+  bool find_multiline(finder_t *finder, find_result_t *result, bool reverse) const;
+  bool next_multiline_match(finder_t *finder, text_coordinate_t from, bool not_empty_at_start,
+                            text_coordinate_t limit, text_pos_t last_start_line,
+                            find_result_t *result) const;
+  bool last_multiline_match(finder_t *finder, text_coordinate_t limit, bool not_empty_at_end,
+                            find_result_t *result) const;
   bool indent_block(text_coordinate_t &start, text_coordinate_t &end, int tabsize, bool tab_spaces);
   bool indent_selection(int tabsize, bool tab_spaces);
   bool undo_indent_selection(undo_t *undo, undo_type_t type);
@@ -22,6 +22,11 @@
 #include <t3window/utf8.h>
 #include <type_traits>
 #include <unictype.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "t3widget/colorscheme.h"
 #include "t3widget/double_string_adapter.h"
@@ -62,14 +67,203 @@ static bool is_conjoining_jamo_lv(uint32_t c) {
   return false;
 }
 
+/* Overlong encodings, surrogates and values above U+10FFFF are not considered valid. Runs of
+   ASCII characters are skipped 16 or 8 bytes at a time. */
+size_t valid_utf8_prefix(string_view str) {
+  const unsigned char *data = reinterpret_cast<const unsigned char *>(str.data());
+  const size_t size = str.size();
+  size_t pos = 0;
+
+  while (pos < size) {
+#ifdef __SSE2__
+    while (pos + 16 <= size &&
+           _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos))) == 0) {
+      pos += 16;
+    }
+#endif
+    while (pos + 8 <= size) {
+      uint64_t word;
+      memcpy(&word, data + pos, sizeof(word));
+      if (word & UINT64_C(0x8080808080808080)) {
+        break;
+      }
+      pos += 8;
+    }
+    if (pos == size) {
+      break;
+    }
+
+    unsigned char c = data[pos];
+    if (c < 0x80) {
+      pos++;
+      continue;
+    }
+
+    size_t char_bytes;
+    unsigned char min_second = 0x80, max_second = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      char_bytes = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      char_bytes = 3;
+      if (c == 0xE0) {
+        min_second = 0xA0;
+      } else if (c == 0xED) {
+        max_second = 0x9F;
+      }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      char_bytes = 4;
+      if (c == 0xF0) {
+        min_second = 0x90;
+      } else if (c == 0xF4) {
+        max_second = 0x8F;
+      }
+    } else {
+      return pos;
+    }
+
+    if (size - pos < char_bytes || data[pos + 1] < min_second || data[pos + 1] > max_second) {
+      return pos;
+    }
+    for (size_t i = 2; i < char_bytes; i++) {
+      if ((data[pos + i] & 0xC0) != 0x80) {
+        return pos;
+      }
+    }
+    pos += char_bytes;
+  }
+  return pos;
+}
+
+/* Lines of at least this size cache the screen width of their characters. */
+static const size_t width_cache_min_size = 256;
+/* Distance in bytes between the positions for which the screen width is cached. */
+static const size_t width_checkpoint_interval = 64;
+
+/* Cache for converting between byte positions and screen columns in long lines, which is filled on
+   demand. Element k of checkpoints holds the screen width of the characters before checkpoint k,
+   which is the start of the character containing byte k * width_checkpoint_interval. As the width
+   of a tab depends on its position, the cache only applies to the part of the line before
+   first_tab. A negative value for first_tab means it has to be determined again. */
+struct width_cache_t {
+  std::vector<text_pos_t> checkpoints;
+  text_pos_t first_tab = -1;
+};
+
 struct text_line_t::implementation_t {
   std::string buffer;
   text_line_factory_t *factory;
   bool starts_with_combining;
+  /* Only allocated for lines of at least width_cache_min_size bytes, when they are first
+     measured, such that short lines do not pay for it. */
+  mutable std::unique_ptr<width_cache_t> width_cache;
 
   implementation_t(text_line_factory_t *_factory)
       : factory(_factory == nullptr ? &default_text_line_factory : _factory),
         starts_with_combining(false) {}
+
+  /* Discard the cached information that depends on the bytes from pos onward. */
+  void invalidate_width_cache(text_pos_t pos) {
+    if (width_cache == nullptr) {
+      return;
+    }
+    if (buffer.size() < width_cache_min_size) {
+      width_cache.reset();
+      return;
+    }
+    size_t valid_checkpoints = (pos + width_checkpoint_interval - 1) / width_checkpoint_interval;
+    if (width_cache->checkpoints.size() > valid_checkpoints) {
+      width_cache->checkpoints.resize(valid_checkpoints);
+    }
+    if (width_cache->first_tab >= pos) {
+      width_cache->first_tab = -1;
+    }
+  }
+
+  /* Returns whether the cache can be used for positions up to end. */
+  bool use_width_cache(text_pos_t end) const {
+    if (buffer.size() < width_cache_min_size) {
+      return false;
+    }
+    if (width_cache == nullptr) {
+      width_cache.reset(new width_cache_t());
+    }
+    text_pos_t &first_tab = width_cache->first_tab;
+    if (first_tab < 0) {
+      const void *tab = memchr(buffer.data(), '\t', buffer.size());
+      first_tab = tab == nullptr ? buffer.size() : static_cast<const char *>(tab) - buffer.data();
+    }
+    return end <= first_tab;
+  }
+
+  text_pos_t checkpoint_pos(size_t checkpoint) const {
+    text_pos_t pos = std::min(checkpoint * width_checkpoint_interval, buffer.size());
+    while (pos > 0 && static_cast<size_t>(pos) < buffer.size() && (buffer[pos] & 0xC0) == 0x80) {
+      pos--;
+    }
+    return pos;
+  }
+
+  /* Returns the screen width of the characters starting in [start, end). */
+  text_pos_t sum_widths(text_pos_t start, text_pos_t end) const {
+    text_pos_t total = 0;
+    for (text_pos_t i = start; i < end; i += byte_width_from_first(buffer, i)) {
+      total += buffer[i] >= 32 && buffer[i] < 127 ? 1 : width_at(buffer, i);
+    }
+    return total;
+  }
+
+  void add_checkpoint() const {
+    std::vector<text_pos_t> &checkpoints = width_cache->checkpoints;
+    if (checkpoints.empty()) {
+      checkpoints.push_back(0);
+      return;
+    }
+    size_t last = checkpoints.size() - 1;
+    checkpoints.push_back(checkpoints[last] +
+                          sum_widths(checkpoint_pos(last), checkpoint_pos(last + 1)));
+  }
+
+  /* Returns the screen width of the characters starting before pos. */
+  text_pos_t width_before(text_pos_t pos) const {
+    size_t checkpoint = pos / width_checkpoint_interval;
+    while (width_cache->checkpoints.size() <= checkpoint) {
+      add_checkpoint();
+    }
+    return width_cache->checkpoints[checkpoint] + sum_widths(checkpoint_pos(checkpoint), pos);
+  }
+
+  /* Returns the first character starting in [start, end) for which the screen width of the
+     characters from start up to and including it is larger than width, or end if there is no
+     such character. */
+  text_pos_t find_width(text_pos_t start, text_pos_t end, text_pos_t width) const {
+    const text_pos_t start_width = width_before(start);
+    const text_pos_t target = start_width + width;
+    /* Only add the checkpoints needed to pass the target width. */
+    const std::vector<text_pos_t> &checkpoints = width_cache->checkpoints;
+    const size_t end_checkpoint = end / width_checkpoint_interval;
+    while (checkpoints.size() <= end_checkpoint && checkpoints.back() <= target) {
+      add_checkpoint();
+    }
+
+    /* Skip to the last checkpoint that does not exceed the target width. The character searched
+       for can not start before it. */
+    size_t checkpoint =
+        std::upper_bound(checkpoints.begin(), checkpoints.end(), target) - checkpoints.begin() - 1;
+    text_pos_t i = checkpoint_pos(checkpoint);
+    text_pos_t total = checkpoints[checkpoint];
+    if (i < start) {
+      i = start;
+      total = start_width;
+    }
+
+    for (; i < end; i += byte_width_from_first(buffer, i)) {
+      total += width_at(buffer, i);
+      if (total > target) {
+        return i;
+      }
+    }
+    return end;
+  }
 };
 
 text_line_t::text_line_t(int buffersize, text_line_factory_t *factory)
@@ -79,23 +273,36 @@ text_line_t::text_line_t(int buffersize, text_line_factory_t *factory)
 
 text_line_t::~text_line_t() {}
 
-void text_line_t::fill_line(string_view _buffer) {
+void append_utf8_normalized(std::string *result, string_view str) {
   size_t char_bytes, round_trip_bytes;
   key_t next;
   char byte_buffer[5];
 
+  while (!str.empty()) {
+    /* Copy valid UTF-8 directly, as the round trip below would not change it. */
+    size_t valid_bytes = valid_utf8_prefix(str);
+    result->append(str.data(), valid_bytes);
+    str.remove_prefix(valid_bytes);
+    if (str.empty()) {
+      break;
+    }
+
+    char_bytes = str.size();
+    next = t3_utf8_get(str.data(), &char_bytes);
+    round_trip_bytes = t3_utf8_put(next, byte_buffer);
+    result->append(byte_buffer, round_trip_bytes);
+    str.remove_prefix(char_bytes);
+  }
+}
+
+void text_line_t::fill_line(string_view _buffer) {
   /* If _buffer is valid UTF-8, we will end up with a buffer of size length.
      So just tell the buffer that, such that it can allocate an appropriately
      sized buffer. */
   reserve(_buffer.size());
+  impl->invalidate_width_cache(impl->buffer.size());
 
-  while (!_buffer.empty()) {
-    char_bytes = _buffer.size();
-    next = t3_utf8_get(_buffer.data(), &char_bytes);
-    round_trip_bytes = t3_utf8_put(next, byte_buffer);
-    impl->buffer.append(byte_buffer, round_trip_bytes);
-    _buffer.remove_prefix(char_bytes);
-  }
+  append_utf8_normalized(&impl->buffer, _buffer);
   impl->starts_with_combining = impl->buffer.size() > 0 && width_at(0) == 0;
 }
 
@@ -117,6 +324,7 @@ void text_line_t::merge(std::unique_ptr<text_line_t> other) {
 
   reserve(impl->buffer.size() + other->impl->buffer.size());
 
+  impl->invalidate_width_cache(impl->buffer.size());
   impl->buffer += other->impl->buffer;
 }
 
@@ -140,6 +348,7 @@ std::unique_ptr<text_line_t> text_line_t::break_line(t3widget::text_pos_t pos) {
   newline->impl->buffer.assign(impl->buffer.data() + pos, impl->buffer.size() - pos);
 
   impl->buffer.resize(pos);
+  impl->invalidate_width_cache(pos);
   return newline;
 }
 
@@ -154,6 +363,7 @@ std::unique_ptr<text_line_t> text_line_t::cut_line(text_pos_t start, text_pos_t
   retval = clone(start, end);
 
   impl->buffer.erase(start, (end - start));
+  impl->invalidate_width_cache(start);
   impl->starts_with_combining = !impl->buffer.empty() && width_at(0) == 0;
 
   return retval;
@@ -200,6 +410,7 @@ void text_line_t::insert(std::unique_ptr<text_line_t> other, t3widget::text_pos_
 
   reserve(impl->buffer.size() + other->impl->buffer.size());
   impl->buffer.insert(pos, other->impl->buffer);
+  impl->invalidate_width_cache(pos);
   if (pos == 0) {
     impl->starts_with_combining = other->impl->starts_with_combining;
   }
@@ -223,6 +434,11 @@ text_pos_t text_line_t::calculate_screen_width(text_pos_t start, text_pos_t pos,
     total++;
   }
 
+  const text_pos_t end = std::min<text_pos_t>(pos, impl->buffer.size());
+  if (start < end && impl->use_width_cache(end)) {
+    return total + impl->width_before(end) - impl->width_before(start);
+  }
+
   for (i = start; static_cast<size_t>(i) < impl->buffer.size() && i < pos;
        i += byte_width_from_first(i)) {
     if (impl->buffer[i] == '\t') {
@@ -249,6 +465,11 @@ text_pos_t text_line_t::calculate_line_pos(text_pos_t start, text_pos_t max, tex
     pos--;
   }
 
+  const text_pos_t end = std::min(max, size());
+  if (start < end && impl->use_width_cache(end)) {
+    return impl->find_width(start, end, pos);
+  }
+
   for (i = start; static_cast<size_t>(i) < impl->buffer.size() && i < max;
        i += byte_width_from_first(i)) {
     if (impl->buffer[i] == '\t') {
@@ -287,7 +508,23 @@ t3_attr_t text_line_t::get_base_attr(text_pos_t i, const text_line_t::paint_info
   return info.normal_attr;
 }
 
+/* Returns whether c is a printable ASCII character. These take a single byte and a single column,
+   and can always be drawn. */
+static bool is_printable_ascii(char c) { return c >= 32 && c < 127; }
+
 t3_attr_t text_line_t::get_draw_attrs(text_pos_t i, const text_line_t::paint_info_t &info) const {
+  t3_attr_t retval = get_selection_attrs(i, info);
+
+  if (is_bad_draw(i)) {
+    retval = t3_term_combine_attrs(attributes.bad_draw, retval);
+  }
+
+  return retval;
+}
+
+/* Returns the attributes for position i, without checking whether it can be drawn. */
+t3_attr_t text_line_t::get_selection_attrs(text_pos_t i,
+                                           const text_line_t::paint_info_t &info) const {
   t3_attr_t retval = get_base_attr(i, info);
 
   if (i >= info.selection_start && i < info.selection_end) {
@@ -299,10 +536,6 @@ t3_attr_t text_line_t::get_draw_attrs(text_pos_t i, const text_line_t::paint_inf
         retval);
   }
 
-  if (is_bad_draw(i)) {
-    retval = t3_term_combine_attrs(attributes.bad_draw, retval);
-  }
-
   return retval;
 }
 
@@ -332,6 +565,7 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
 
   const size_t buffer_size = impl->buffer.size();
   const char *buffer_data = impl->buffer.data();
+  const text_pos_t limit = std::min<text_pos_t>(buffer_size, info.max);
 
   text_pos_t i;
   for (i = info.start; static_cast<size_t>(i) < buffer_size && i < info.max && total < info.leftcol;
@@ -371,6 +605,16 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
           win->addch('<', t3_term_combine_attrs(attributes.non_print, selection_attr));
         }
       }
+    } else if (is_printable_ascii(buffer_data[i])) {
+      total++;
+      /* Skip over all following printable ASCII characters at once. */
+      if (i + 1 < limit && total < info.leftcol && is_printable_ascii(buffer_data[i + 1])) {
+        do {
+          ++i;
+          ++total;
+        } while (i + 1 < limit && total < info.leftcol && is_printable_ascii(buffer_data[i + 1]));
+        selection_attr = get_selection_attrs(i, info);
+      }
     } else {
       total += width_at(i);
     }
@@ -475,6 +719,17 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
       total += accumulated;
       accumulated = width_at(i);
       print_from = i;
+    } else if (is_printable_ascii(buffer_data[i])) {
+      /* The loop condition guarantees there is room for a single column character. Add all
+         following printable ASCII characters with the same attributes at once, as they need none
+         of the checks above. */
+      accumulated++;
+      while (i + 1 < limit && total + accumulated < size &&
+             is_printable_ascii(buffer_data[i + 1]) &&
+             get_selection_attrs(i + 1, info) == selection_attr) {
+        ++i;
+        ++accumulated;
+      }
     } else {
       /* Take care of double width characters that cross the right screen edge. */
       if (total + accumulated + width_at(i) > size) {
@@ -692,11 +947,8 @@ bool text_line_t::insert_char(text_pos_t pos, key_t c, undo_t *undo) {
   reserve(impl->buffer.size() + conversion_length + 1);
 
   if (undo != nullptr) {
-    tiny_string_t *undo_text = undo->get_text();
-    undo_text->reserve(undo_text->size() + conversion_length);
-
     ASSERT(undo->get_type() == UNDO_ADD);
-    undo_text->append(string_view(conversion_buffer, conversion_length));
+    undo->get_text()->append(string_view(conversion_buffer, conversion_length));
   }
 
   if (pos == 0) {
@@ -704,6 +956,7 @@ bool text_line_t::insert_char(text_pos_t pos, key_t c, undo_t *undo) {
   }
 
   impl->buffer.insert(pos, conversion_buffer, conversion_length);
+  impl->invalidate_width_cache(pos);
   return true;
 }
 
@@ -747,6 +1000,7 @@ bool text_line_t::overwrite_char(text_pos_t pos, key_t c, undo_t *undo) {
   }
 
   impl->buffer.replace(pos, oldspace, conversion_buffer, conversion_length);
+  impl->invalidate_width_cache(pos);
   return true;
 }
 
@@ -774,6 +1028,7 @@ bool text_line_t::delete_char(text_pos_t pos, undo_t *undo) {
   }
 
   impl->buffer.erase(pos, oldspace);
+  impl->invalidate_width_cache(pos);
   return true;
 }
 
@@ -808,6 +1063,7 @@ bool text_line_t::backspace_word(text_pos_t pos, text_pos_t newpos, undo_t *undo
   }
 
   impl->buffer.erase(newpos, oldspace);
+  impl->invalidate_width_cache(newpos);
 
   return true;
 }
@@ -88,6 +88,7 @@ class T3_WIDGET_API text_line_t {
   static int width_at(string_view str, text_pos_t pos);
 
   t3_attr_t get_draw_attrs(text_pos_t i, const paint_info_t &info) const;
+  t3_attr_t get_selection_attrs(text_pos_t i, const paint_info_t &info) const;
 
   void fill_line(string_view _buffer);
   bool check_boundaries(text_pos_t match_start, text_pos_t match_end) const;
@@ -145,10 +145,14 @@ tiny_string_t &tiny_string_t::assign(const tiny_string_t &other) {
 }
 
 tiny_string_t &tiny_string_t::assign(tiny_string_t &&other) {
+  if (this == &other) {
+    return *this;
+  }
   if (!is_short()) {
     std::free(ptr);
   }
   std::memcpy(bytes, other.bytes, sizeof(bytes));
+  other.mutable_signal_byte() = 1;
   return *this;
 }
 
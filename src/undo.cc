@@ -11,76 +11,581 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <deque>
+#include <limits>
+#include <memory>
+#include <string>
 #include <type_traits>
+#include <utility>
 
+#include "t3widget/string_view.h"
 #include "t3widget/tinystring.h"
 #include "t3widget/undo.h"
+#include "t3widget/undojournal.h"
 #include "t3widget/util.h"
 
 namespace t3widget {
+
+/* Minimum size of the spill file before it is rewritten to drop the text of discarded records. */
+static const long min_spill_rewrite = 1024 * 1024;
+/* Size of the chunks the text of the records is allocated from. */
+static const size_t arena_chunk_size = 64 * 1024;
+/* Largest text buffer that is kept for use by the next record. */
+static const size_t max_reused_text = 4096;
+
+namespace {
+
+/* Append-only storage for the text of undo records. Text is allocated from large chunks, which
+   are only freed when none of the text allocated from them is in use anymore. As records are
+   stored in the order in which they were created, and history is discarded oldest first, whole
+   chunks are freed at once. Chunks are identified by a sequence number. */
+class text_arena_t {
+ public:
+  static const size_t no_chunk = std::numeric_limits<size_t>::max();
+
+  /* Allocate size bytes. The number of the chunk they were allocated from is stored in chunk. */
+  char *allocate(size_t size, size_t *chunk) {
+    if (size == 0) {
+      *chunk = no_chunk;
+      return nullptr;
+    }
+    /* Large blocks of text get a chunk of their own, to prevent wasting most of a chunk. */
+    if (size > arena_chunk_size / 4) {
+      *chunk = add_chunk(size);
+    } else {
+      if (current_chunk == no_chunk ||
+          get_chunk(current_chunk).fill + size > get_chunk(current_chunk).size) {
+        current_chunk = add_chunk(arena_chunk_size);
+      }
+      *chunk = current_chunk;
+    }
+    chunk_t &c = get_chunk(*chunk);
+    char *result = c.data.get() + c.fill;
+    c.fill += size;
+    c.live += size;
+    live += size;
+    return result;
+  }
+
+  string_view store(string_view text, size_t *chunk) {
+    char *data = allocate(text.size(), chunk);
+    if (data == nullptr) {
+      return string_view();
+    }
+    std::memcpy(data, text.data(), text.size());
+    return string_view(data, text.size());
+  }
+
+  /* Mark size bytes allocated from chunk as no longer in use. */
+  void release(size_t chunk, size_t size) {
+    if (chunk == no_chunk) {
+      return;
+    }
+    chunk_t &c = get_chunk(chunk);
+    c.live -= size;
+    live -= size;
+    if (c.live != 0) {
+      return;
+    }
+    if (chunk == current_chunk) {
+      c.fill = 0;
+      return;
+    }
+    allocated -= c.size;
+    c.data.reset();
+    while (!chunks.empty() && chunks.front().data == nullptr) {
+      chunks.pop_front();
+      ++first_chunk;
+    }
+  }
+
+  /* Returns the number of bytes allocated from the system. */
+  size_t get_allocated() const { return allocated; }
+  /* Returns the number of bytes in use. */
+  size_t get_live() const { return live; }
+
+ private:
+  struct chunk_t {
+    std::unique_ptr<char[]> data;
+    size_t size, fill = 0, live = 0;
+
+    explicit chunk_t(size_t _size) : data(new char[_size]), size(_size) {}
+  };
+
+  size_t add_chunk(size_t size) {
+    chunks.emplace_back(size);
+    allocated += size;
+    return first_chunk + chunks.size() - 1;
+  }
+
+  chunk_t &get_chunk(size_t chunk) { return chunks[chunk - first_chunk]; }
+
+  std::deque<chunk_t> chunks;
+  /* Sequence number of the first chunk in chunks. */
+  size_t first_chunk = 0;
+  /* Chunk small allocations are taken from. */
+  size_t current_chunk = no_chunk;
+  size_t allocated = 0, live = 0;
+};
+
+}  // namespace
+
 struct undo_list_t::implementation_t {
-  std::deque<undo_t> list;
-  std::deque<undo_t>::iterator current = list.end(), mark = list.end();
+  struct record_t {
+    undo_t undo;
+    /* Chunk of the arena the saved text of the record was allocated from. */
+    size_t chunk = text_arena_t::no_chunk;
+    /* Location and size of the text in the spill file. The offset is -1 if the text has not
+       been written to the spill file. */
+    long spill_offset = -1;
+    size_t spill_size = 0;
+    /* Whether the text is in memory. If not, it has to be read from the spill file first. */
+    bool in_memory = true;
+    /* Number of records merged into this record, which is the number of records it represents
+       in the journal. */
+    size_t merged = 1;
+
+    record_t(undo_type_t type, text_coordinate_t coord) : undo(type, coord) {}
+  };
+
+  std::deque<record_t> list;
+  /* The records before current have been applied, the others can be redone. The mark is the
+     value of current at the time set_mark was called. */
+  size_t current = 0, mark = 0;
   bool mark_is_valid = true;
-  bool mark_beyond_current = false;
 
-  undo_t *add(undo_type_t type, text_coordinate_t coord) {
-    if (list.empty()) {
-      mark = list.emplace(list.end(), type, coord);
-      current = list.end();
-      return &*mark;
+  text_arena_t arena;
+  /* Text buffer of the last saved record, which is reused for the next record. */
+  tiny_string_t free_text;
+
+  std::unique_ptr<undo_journal_t> journal;
+  /* Number of records in the journal, and the number of them before current. */
+  size_t journal_size = 0, journal_current = 0;
+
+  /* Memory limit, or 0 for no limit. */
+  size_t limit = 0;
+  /* Memory used by all records except the last, which may still be extended. */
+  size_t used = 0;
+
+  bool spill = false;
+  std::FILE *spill_file = nullptr;
+  /* Size of the spill file, and the number of bytes in it still referred to by a record. */
+  long spill_file_size = 0, spill_live = 0;
+
+  ~implementation_t() {
+    if (journal != nullptr && !list.empty() && !list.back().undo.saved) {
+      save(&list.back());
+    }
+    if (spill_file != nullptr) {
+      std::fclose(spill_file);
     }
+  }
 
-    // Everything beyond current will be deleted, so mark will be invalid afterwards.
-    if (mark_beyond_current) {
-      mark_is_valid = false;
+  static size_t record_size(const record_t &record) {
+    return sizeof(record_t) + record.undo.saved_text.size();
+  }
+
+  /* Move the text of a record that can no longer be extended to the arena. */
+  void save(record_t *record) {
+    undo_t &undo = record->undo;
+    undo.saved_text = arena.store(undo.text, &record->chunk);
+    undo.saved = true;
+    used += record_size(*record);
+    if (journal != nullptr) {
+      journal->add_record(undo.type, undo.start, undo.saved_text);
     }
 
-    const bool mark_at_current = mark_is_valid && current == mark;
-    if (current != list.end()) {
-      list.erase(current, list.end());
+    if (undo.text.size() > max_reused_text) {
+      undo.text.clear();
+      undo.text.shrink_to_fit();
+    } else {
+      undo.text.clear();
+      free_text = std::move(undo.text);
     }
-    auto iter = list.emplace(list.end(), type, coord);
-    current = list.end();
-    if (mark_at_current) {
-      mark = iter;
+  }
+
+  void release(record_t *record) {
+    arena.release(record->chunk, record->undo.saved_text.size());
+    record->chunk = text_arena_t::no_chunk;
+    record->undo.saved_text = string_view();
+  }
+
+  void forget_spilled(record_t *record) {
+    if (record->spill_offset >= 0) {
+      spill_live -= record->spill_size;
+      record->spill_offset = -1;
     }
-    return &*iter;
   }
 
-  undo_t *back() {
-    if (current == list.begin()) {
-      return nullptr;
+  /* Remove the records in the range [first, last). */
+  void erase(size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      if (list[i].undo.saved) {
+        used -= record_size(list[i]);
+      }
+      release(&list[i]);
+      forget_spilled(&list[i]);
     }
+    list.erase(list.begin() + first, list.begin() + last);
+  }
 
-    if (mark_is_valid && current == mark) {
-      mark_beyond_current = true;
+  undo_t *add(undo_type_t type, text_coordinate_t coord) {
+    // Everything beyond current will be deleted, so mark will be invalid afterwards.
+    if (mark_is_valid && mark > current) {
+      mark_is_valid = false;
+    }
+    if (current < list.size()) {
+      erase(current, list.size());
+      journal_size = journal_current;
+      if (journal != nullptr) {
+        journal->truncate(journal_size);
+      }
     }
 
-    return &*--current;
-  }
+    if (!list.empty() && !list.back().undo.saved) {
+      // The last record can no longer be extended.
+      save(&list.back());
+    }
 
-  undo_t *forward() {
-    if (current == list.end()) {
+    if (limit != 0 && used > limit) {
+      enforce_limit();
+    }
+
+    list.emplace_back(type, coord);
+    list.back().undo.text = std::move(free_text);
+    current = list.size();
+    journal_current = ++journal_size;
+    return &list.back().undo;
+  }
+  undo_t *back() {
+    if (current == 0) {
       return nullptr;
     }
-    undo_t *retval = &*current;
-    ++current;
+    --current;
+    journal_current -= list[current].merged;
+    load(&list[current]);
+    return &list[current].undo;
+  }
 
-    if (mark_is_valid && mark_beyond_current && current == mark) {
-      mark_beyond_current = false;
+  undo_t *forward() {
+    if (current == list.size()) {
+      return nullptr;
     }
-    return retval;
+    load(&list[current]);
+    journal_current += list[current].merged;
+    return &list[current++].undo;
   }
 
-  void set_mark() {
+  void set_mark(size_t hash) {
     mark_is_valid = true;
-    mark_beyond_current = false;
     mark = current;
+    // Make sure the journal contains all changes up to the mark.
+    if (!list.empty() && !list.back().undo.saved) {
+      save(&list.back());
+    }
+    if (journal != nullptr) {
+      journal->set_mark(journal_current, hash);
+    }
+  }
+
+  int open_journal(const std::string &name, size_t hash) {
+    std::vector<undo_journal_t::record_t> records;
+    size_t journal_mark = 0;
+    if (list.empty() && undo_journal_t::read(name, hash, &records, &journal_mark)) {
+      for (undo_journal_t::record_t &record : records) {
+        list.emplace_back(record.type, record.start);
+        list.back().undo.text = std::move(record.text);
+        save(&list.back());
+      }
+      current = mark = journal_mark;
+      mark_is_valid = true;
+    }
+
+    int error;
+    journal = undo_journal_t::create(name, &error);
+    if (journal == nullptr) {
+      return error;
+    }
+
+    /* The new journal starts with the current history. */
+    if (!list.empty() && !list.back().undo.saved) {
+      save(&list.back());
+    }
+    journal_size = journal_current = 0;
+    for (size_t i = 0; i < list.size(); ++i) {
+      load(&list[i]);
+      journal->add_record(list[i].undo.type, list[i].undo.start, list[i].undo.saved_text);
+      list[i].merged = 1;
+      journal_size++;
+      if (i < current) {
+        journal_current++;
+      }
+    }
+    if (mark_is_valid && mark == current) {
+      journal->set_mark(journal_current, hash);
+    }
+    if (limit != 0 && used > limit) {
+      enforce_limit();
+    }
+    return 0;
   }
 
   bool is_at_mark() const { return mark_is_valid && mark == current; }
+
+  /* Reduce the memory used to three quarters of the limit, leaving room to grow before the
+     history has to be reduced again. Only the history before current is changed. The text
+     buffer does not keep pointers to records other than the last, which is accounted for in
+     used when this is called, so records may be moved freely. */
+  void enforce_limit() {
+    const size_t target = limit - limit / 4;
+
+    compact();
+    if (spill) {
+      for (size_t i = 0; i < current && used > target; ++i) {
+        if (!write_spilled(&list[i])) {
+          break;
+        }
+      }
+    }
+    while (used > target) {
+      size_t count = oldest_undo_step();
+      if (count == 0) {
+        break;
+      }
+      erase(0, count);
+      current -= count;
+      if (mark_is_valid) {
+        if (mark < count) {
+          mark_is_valid = false;
+        } else {
+          mark -= count;
+        }
+      }
+    }
+
+    if (spill_file != nullptr && spill_file_size > min_spill_rewrite &&
+        spill_file_size > 2 * spill_live) {
+      rewrite_spill_file();
+    }
+    if (arena.get_allocated() > 2 * arena.get_live() + arena_chunk_size) {
+      rewrite_arena();
+    }
+  }
+
+  /* Returns the number of records making up the oldest undo step, or 0 if it can not be removed
+     because it has not been applied or is not complete. */
+  size_t oldest_undo_step() const {
+    size_t depth = 0;
+    for (size_t i = 0; i < current; ++i) {
+      undo_type_t type = list[i].undo.get_type();
+      if (type == UNDO_BLOCK_START) {
+        ++depth;
+      } else if (type == UNDO_BLOCK_END && depth > 0) {
+        --depth;
+      }
+      if (depth == 0) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  /* Merge adjacent records that can be undone as a single record. This makes undo steps in the
+     oldest history coarser, which is preferable to losing them. */
+  void compact() {
+    size_t new_current = current, new_mark = mark;
+    size_t write = 0;
+    for (size_t read = 0; read < list.size(); ++read) {
+      if (read == current) {
+        new_current = write;
+      }
+      if (read == mark) {
+        new_mark = write;
+      }
+      if (write > 0 && read < current && !(mark_is_valid && read == mark) &&
+          merge(&list[write - 1], &list[read])) {
+        list[write - 1].merged += list[read].merged;
+        used -= sizeof(record_t);
+        continue;
+      }
+      if (write != read) {
+        list[write] = std::move(list[read]);
+      }
+      ++write;
+    }
+    if (current == list.size()) {
+      new_current = write;
+    }
+    if (mark == list.size()) {
+      new_mark = write;
+    }
+    list.erase(list.begin() + write, list.end());
+    current = new_current;
+    mark = new_mark;
+  }
+
+  /* Merge record next into record prev, if they record consecutive typing or deletion on a
+     single line. */
+  bool merge(record_t *prev, record_t *next) {
+    if (!prev->in_memory || !next->in_memory) {
+      return false;
+    }
+    undo_type_t type = prev->undo.get_type();
+    if (type != next->undo.get_type()) {
+      return false;
+    }
+
+    string_view prev_text = prev->undo.saved_text;
+    string_view next_text = next->undo.saved_text;
+    if (prev_text.find('\n') != string_view::npos || next_text.find('\n') != string_view::npos) {
+      return false;
+    }
+    text_coordinate_t prev_start = prev->undo.get_start();
+    text_coordinate_t next_start = next->undo.get_start();
+    if (prev_start.line != next_start.line) {
+      return false;
+    }
+    text_pos_t prev_size = prev_text.size();
+
+    switch (type) {
+      case UNDO_ADD:
+        if (next_start.pos != prev_start.pos + prev_size) {
+          return false;
+        }
+        break;
+      case UNDO_DELETE:
+        if (next_start.pos != prev_start.pos) {
+          return false;
+        }
+        break;
+      case UNDO_BACKSPACE:
+        if (next_start.pos != prev_start.pos - prev_size) {
+          return false;
+        }
+        // Backspacing prepends the deleted text.
+        std::swap(prev_text, next_text);
+        break;
+      default:
+        return false;
+    }
+
+    if (prev->chunk == next->chunk && prev->chunk != text_arena_t::no_chunk &&
+        prev_text.data() + prev_text.size() == next_text.data()) {
+      /* The records were saved one after the other, so the merged text is already in the arena.
+         The text of next now belongs to prev. */
+      prev->undo.saved_text = string_view(prev_text.data(), prev_text.size() + next_text.size());
+      next->chunk = text_arena_t::no_chunk;
+      next->undo.saved_text = string_view();
+    } else {
+      size_t chunk;
+      char *data = arena.allocate(prev_text.size() + next_text.size(), &chunk);
+      std::memcpy(data, prev_text.data(), prev_text.size());
+      std::memcpy(data + prev_text.size(), next_text.data(), next_text.size());
+      release(prev);
+      release(next);
+      prev->chunk = chunk;
+      prev->undo.saved_text = string_view(data, prev_text.size() + next_text.size());
+    }
+    forget_spilled(prev);
+    forget_spilled(next);
+    return true;
+  }
+
+  /* Remove the text of a record from memory, writing it to the spill file if necessary. */
+  bool write_spilled(record_t *record) {
+    if (!record->in_memory) {
+      return true;
+    }
+    string_view text = record->undo.saved_text;
+    if (text.empty()) {
+      return true;
+    }
+    if (record->spill_offset < 0) {
+      if (spill_file == nullptr) {
+        spill_file = std::tmpfile();
+        if (spill_file == nullptr) {
+          return false;
+        }
+      }
+      if (std::fseek(spill_file, spill_file_size, SEEK_SET) != 0 ||
+          std::fwrite(text.data(), 1, text.size(), spill_file) != text.size()) {
+        return false;
+      }
+      record->spill_offset = spill_file_size;
+      record->spill_size = text.size();
+      spill_file_size += text.size();
+      spill_live += text.size();
+    }
+    used -= text.size();
+    release(record);
+    record->in_memory = false;
+    return true;
+  }
+
+  /* Make sure the text of a record is in memory. The spilled copy is kept, such that the text
+     can be removed from memory again without writing it. */
+  void load(record_t *record) {
+    if (record->in_memory) {
+      return;
+    }
+    record->in_memory = true;
+    char *data = arena.allocate(record->spill_size, &record->chunk);
+    record->undo.saved_text = string_view(data, record->spill_size);
+    if (std::fseek(spill_file, record->spill_offset, SEEK_SET) != 0 ||
+        std::fread(data, 1, record->spill_size, spill_file) != record->spill_size) {
+      /* There is no sensible way to recover from a failure to read back the text. Leaving the
+         text empty at least leaves the text buffer in a consistent state. */
+      release(record);
+      forget_spilled(record);
+    }
+    used += record->undo.saved_text.size();
+  }
+
+  /* Copy the text that is still in use to a new arena. */
+  void rewrite_arena() {
+    text_arena_t new_arena;
+    for (record_t &record : list) {
+      if (record.undo.saved) {
+        record.undo.saved_text = new_arena.store(record.undo.saved_text, &record.chunk);
+      }
+    }
+    arena = std::move(new_arena);
+  }
+
+  /* Copy the text that is still referred to to a new spill file. */
+  void rewrite_spill_file() {
+    std::FILE *new_file = std::tmpfile();
+    if (new_file == nullptr) {
+      return;
+    }
+    long new_size = 0;
+    std::string buffer;
+    for (record_t &record : list) {
+      if (record.spill_offset < 0) {
+        continue;
+      }
+      if (record.in_memory) {
+        forget_spilled(&record);
+        continue;
+      }
+      buffer.resize(record.spill_size);
+      if (std::fseek(spill_file, record.spill_offset, SEEK_SET) != 0 ||
+          std::fread(&buffer[0], 1, record.spill_size, spill_file) != record.spill_size ||
+          std::fwrite(buffer.data(), 1, record.spill_size, new_file) != record.spill_size) {
+        std::fclose(new_file);
+        return;
+      }
+      record.spill_offset = new_size;
+      new_size += record.spill_size;
+    }
+    std::fclose(spill_file);
+    spill_file = new_file;
+    spill_file_size = new_size;
+    spill_live = new_size;
+  }
 };
 
 undo_list_t::undo_list_t() : impl(new implementation_t) {}
@@ -94,10 +599,21 @@ undo_t *undo_list_t::back() { return impl->back(); }
 
 undo_t *undo_list_t::forward() { return impl->forward(); }
 
-void undo_list_t::set_mark() { impl->set_mark(); }
+void undo_list_t::set_mark(size_t hash) { impl->set_mark(hash); }
 
 bool undo_list_t::is_at_mark() const { return impl->is_at_mark(); }
 
+int undo_list_t::open_journal(const std::string &name, size_t hash) {
+  return impl->open_journal(name, hash);
+}
+
+bool undo_list_t::is_journaled() const { return impl->journal != nullptr; }
+
+void undo_list_t::set_memory_limit(size_t limit, bool spill) {
+  impl->limit = limit;
+  impl->spill = spill;
+}
+
 #if 0
 #ifdef DEBUG
 #include "log.h"
@@ -146,15 +662,17 @@ void undo_list_t::dump() {
 #endif
 #endif
 
+/* Maps the undo_type_t to the type used for redoing the operation. Must contain an entry for
+   every undo_type_t up to and including UNDO_BLOCK_END. */
 undo_type_t undo_t::redo_map[] = {
-    UNDO_NONE,     UNDO_ADD,    UNDO_BACKSPACE_REDO,   UNDO_ADD_REDO,      UNDO_OVERWRITE_REDO,
-    UNDO_UNINDENT, UNDO_INDENT, UNDO_BLOCK_START_REDO, UNDO_BLOCK_END_REDO};
+    UNDO_NONE, UNDO_ADD, UNDO_BACKSPACE_REDO, UNDO_BACKSPACE_REDO, UNDO_ADD_REDO,
+    UNDO_OVERWRITE_REDO, UNDO_UNINDENT, UNDO_INDENT, UNDO_BLOCK_START_REDO, UNDO_BLOCK_END_REDO};
 
 undo_type_t undo_t::get_type() const { return type; }
 undo_type_t undo_t::get_redo_type() const { return redo_map[type]; }
 text_coordinate_t undo_t::get_start() { return start; }
 void undo_t::add_newline() { text.append(1, '\n'); }
 tiny_string_t *undo_t::get_text() { return &text; }
-void undo_t::minimize() { text.shrink_to_fit(); }
+string_view undo_t::get_text_view() const { return saved ? saved_text : string_view(text); }
 
 }  // namespace t3widget
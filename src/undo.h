@@ -14,7 +14,9 @@
 #ifndef T3_WIDGET_UNDO_H
 #define T3_WIDGET_UNDO_H
 
+#include <cstddef>
 #include <string>
+#include <t3widget/string_view.h>
 #include <t3widget/textline.h>
 #include <t3widget/tinystring.h>
 #include <t3widget/util.h>
@@ -59,8 +61,36 @@ class T3_WIDGET_API undo_list_t {
   undo_t *add(undo_type_t type, text_coordinate_t coord);
   undo_t *back();
   undo_t *forward();
-  void set_mark();
+  /** Mark the current position in the history as the saved state of the text.
+      @param hash The hash of the text, see line_store_t::hash. Only used when the history is
+          written to a journal. */
+  void set_mark(size_t hash = 0);
   bool is_at_mark() const;
+  /** Limit the memory used by the undo history.
+      @param limit The number of bytes the history may use, or 0 for no limit.
+      @param spill Whether to write the text of old records to a temporary file, rather than
+          discarding the records.
+
+      When the limit is exceeded, adjacent records for typing or deleting on a single line are
+      first merged. If that is not enough, the text of the oldest records is written to a
+      temporary file if @p spill is @c true, and read back when the record is undone. Finally,
+      the oldest undo steps are discarded. Records that can still be redone and the record that
+      is currently being extended are never changed.
+  */
+  void set_memory_limit(size_t limit, bool spill);
+  /** Write the history to a journal file, and restore the history from it if possible.
+      @param name The name of the journal file.
+      @param hash The hash of the current text, see line_store_t::hash.
+      @return 0 on success, or an @c errno value on failure.
+
+      If the history is empty, and the journal @p name was last marked for text with hash
+      @p hash, the history is restored from it. The current position is the mark, so records
+      added after the text was last saved can be redone. The journal is then replaced by a new
+      one, starting with the current history. See undo_journal_t for details.
+  */
+  int open_journal(const std::string &name, size_t hash);
+  /** Returns whether the history is written to a journal. */
+  bool is_journaled() const;
 
 #ifdef DEBUG
   void dump();
@@ -68,12 +98,18 @@ class T3_WIDGET_API undo_list_t {
 };
 
 class T3_WIDGET_API undo_t {
+  friend class undo_list_t;
+
  private:
   static undo_type_t redo_map[];
 
+  /* The text while the record is being extended. Once the next record is added, the text is
+     moved to storage owned by the undo_list_t, and saved_text refers to it. */
   tiny_string_t text;
+  string_view saved_text;
   text_coordinate_t start;
   undo_type_t type;
+  bool saved = false;
 
  public:
   undo_t(undo_type_t _type, text_coordinate_t _start) : start(_start), type(_type) {}
@@ -81,8 +117,10 @@ class T3_WIDGET_API undo_t {
   undo_type_t get_redo_type() const;
   text_coordinate_t get_start();
   void add_newline();
+  /** Get the text for extending the record. Only valid for the most recently added record. */
   tiny_string_t *get_text();
-  void minimize();
+  /** Get the text of the record. */
+  string_view get_text_view() const;
 };
 
 }  // namespace t3widget
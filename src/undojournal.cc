@@ -0,0 +1,251 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "t3widget/string_view.h"
+#include "t3widget/undo.h"
+#include "t3widget/undojournal.h"
+#include "t3widget/util.h"
+
+namespace t3widget {
+
+/* The journal starts with the magic string, followed by byte_order_marker as a 32-bit number and
+   the size of size_t as a single byte. */
+static const char journal_magic[8] = {'T', '3', 'U', 'N', 'D', 'O', '1', '\n'};
+static const uint32_t byte_order_marker = 0x01020304;
+
+/* Entry kinds. Records consist of the type as a single byte, the line and position of the start
+   as 64-bit numbers, and the size of the text as a 64-bit number followed by the text.
+   Truncations consist of the new number of records, and marks of the position followed by the
+   hash, all as 64-bit numbers. */
+enum : char { ENTRY_RECORD = 'R', ENTRY_TRUNCATE = 'T', ENTRY_MARK = 'M' };
+
+namespace {
+
+template <typename T>
+void put(std::string *out, T value) {
+  out->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+/* Sequential reader for the contents of a journal. */
+class journal_reader_t {
+ public:
+  explicit journal_reader_t(string_view _data) : data(_data) {}
+
+  template <typename T>
+  bool get(T *value) {
+    if (data.size() < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(value, data.data(), sizeof(T));
+    data.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  bool get_text(size_t size, std::string *text) {
+    if (data.size() < size) {
+      return false;
+    }
+    text->assign(data.data(), size);
+    data.remove_prefix(size);
+    return true;
+  }
+
+ private:
+  string_view data;
+};
+
+bool read_file(const std::string &name, std::string *contents) {
+  std::FILE *file = std::fopen(name.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  char buffer[16384];
+  size_t bytes_read;
+  while ((bytes_read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents->append(buffer, bytes_read);
+  }
+  bool result = !std::ferror(file);
+  std::fclose(file);
+  return result;
+}
+
+}  // namespace
+
+bool undo_journal_t::read(const std::string &name, size_t hash, std::vector<record_t> *records,
+                          size_t *mark) {
+  std::string contents;
+  if (!read_file(name, &contents)) {
+    return false;
+  }
+
+  journal_reader_t reader(contents);
+  char magic[sizeof(journal_magic)];
+  uint32_t marker;
+  uint8_t size_t_size;
+  if (!reader.get(&magic) || std::memcmp(magic, journal_magic, sizeof(magic)) != 0 ||
+      !reader.get(&marker) || marker != byte_order_marker || !reader.get(&size_t_size) ||
+      size_t_size != sizeof(size_t)) {
+    return false;
+  }
+
+  bool mark_valid = false;
+  uint64_t mark_position = 0, mark_hash = 0;
+  records->clear();
+  /* The loop ends at the end of the journal, or at the first incomplete or invalid entry. */
+  while (true) {
+    char kind;
+    if (!reader.get(&kind)) {
+      break;
+    }
+    if (kind == ENTRY_RECORD) {
+      uint8_t type;
+      int64_t line, pos;
+      uint64_t size;
+      record_t record;
+      if (!reader.get(&type) || !reader.get(&line) || !reader.get(&pos) || !reader.get(&size) ||
+          type == UNDO_NONE || type > UNDO_BLOCK_END || !reader.get_text(size, &record.text)) {
+        break;
+      }
+      record.type = static_cast<undo_type_t>(type);
+      record.start = text_coordinate_t(line, pos);
+      records->push_back(std::move(record));
+    } else if (kind == ENTRY_TRUNCATE) {
+      uint64_t size;
+      if (!reader.get(&size)) {
+        break;
+      }
+      if (size < records->size()) {
+        records->resize(size);
+      }
+      /* The text at the mark can no longer be reached if records before it were discarded. */
+      if (size < mark_position) {
+        mark_valid = false;
+      }
+    } else if (kind == ENTRY_MARK) {
+      uint64_t position, entry_hash;
+      if (!reader.get(&position) || !reader.get(&entry_hash)) {
+        break;
+      }
+      mark_valid = position <= records->size();
+      mark_position = position;
+      mark_hash = entry_hash;
+    } else {
+      break;
+    }
+  }
+
+  if (!mark_valid || mark_hash != hash || mark_position > records->size()) {
+    records->clear();
+    return false;
+  }
+  *mark = mark_position;
+  return true;
+}
+
+std::unique_ptr<undo_journal_t> undo_journal_t::create(const std::string &name, int *error) {
+  std::FILE *file = std::fopen(name.c_str(), "wb");
+  if (file == nullptr) {
+    *error = errno;
+    return nullptr;
+  }
+  std::unique_ptr<undo_journal_t> result(new undo_journal_t(file));
+
+  std::string header(journal_magic, sizeof(journal_magic));
+  put(&header, byte_order_marker);
+  put<uint8_t>(&header, sizeof(size_t));
+  result->queue(header);
+  return result;
+}
+
+undo_journal_t::undo_journal_t(std::FILE *_file) : file(_file) {
+  writer = std::thread(&undo_journal_t::write_entries, this);
+}
+
+undo_journal_t::~undo_journal_t() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stop = true;
+  }
+  cond.notify_one();
+  writer.join();
+  std::fclose(file);
+}
+
+void undo_journal_t::add_record(undo_type_t type, text_coordinate_t start, string_view text) {
+  entry.clear();
+  put(&entry, static_cast<char>(ENTRY_RECORD));
+  put<uint8_t>(&entry, type);
+  put<int64_t>(&entry, start.line);
+  put<int64_t>(&entry, start.pos);
+  put<uint64_t>(&entry, text.size());
+  entry.append(text.data(), text.size());
+  queue(entry);
+}
+
+void undo_journal_t::truncate(size_t size) {
+  entry.clear();
+  put(&entry, static_cast<char>(ENTRY_TRUNCATE));
+  put<uint64_t>(&entry, size);
+  queue(entry);
+}
+
+void undo_journal_t::set_mark(size_t position, size_t hash) {
+  entry.clear();
+  put(&entry, static_cast<char>(ENTRY_MARK));
+  put<uint64_t>(&entry, position);
+  put<uint64_t>(&entry, hash);
+  queue(entry);
+}
+
+void undo_journal_t::queue(const std::string &data) {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    pending.append(data);
+  }
+  cond.notify_one();
+}
+
+/* Runs in the writer thread. All entries queued since the previous write are written at once. */
+void undo_journal_t::write_entries() {
+  std::string batch;
+  std::unique_lock<std::mutex> l(lock);
+  while (true) {
+    cond.wait(l, [this] { return stop || !pending.empty(); });
+    if (pending.empty()) {
+      return;
+    }
+    batch.swap(pending);
+    l.unlock();
+
+    if (!failed && (std::fwrite(batch.data(), 1, batch.size(), file) != batch.size() ||
+                    std::fflush(file) != 0)) {
+      failed = true;
+    }
+    batch.clear();
+    l.lock();
+  }
+}
+
+}  // namespace t3widget
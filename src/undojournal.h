@@ -0,0 +1,106 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_UNDOJOURNAL_H
+#define T3_WIDGET_UNDOJOURNAL_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <t3widget/string_view.h>
+#include <t3widget/undo.h>
+#include <t3widget/util.h>
+#include <thread>
+#include <vector>
+
+namespace t3widget {
+
+/** Class writing the history of an undo_list_t to a journal file.
+
+    The journal is a sequence of entries of three kinds: undo records, in the order in which they
+    were added; truncations of the list of records, when records that could be redone are
+    discarded; and marks. A mark stores the position in the list of records at which the text
+    was saved, together with a hash of the text at that point. When the same file is opened
+    again and its text has the same hash, the history up to the last mark can be undone, and the
+    records after it redone.
+
+    Entries are encoded by the thread making the changes, but written to the file in batches by
+    a background thread. If the program stops unexpectedly, the journal may therefore miss the
+    last changes, and end with an incomplete entry. Such an entry is ignored when reading the
+    journal.
+
+    Numbers are stored in the native byte order. A journal written on a platform with a
+    different byte order or size of @c size_t is not read.
+*/
+class T3_WIDGET_LOCAL undo_journal_t {
+ public:
+  /** An undo record read from a journal. */
+  struct record_t {
+    undo_type_t type;
+    text_coordinate_t start;
+    std::string text;
+  };
+
+  /** Read the journal @p name.
+      @param name The name of the journal file.
+      @param hash The hash of the current text.
+      @param records Location to store the undo records.
+      @param mark Location to store the position of the last mark in @p records.
+      @return @c true if the journal was read, and the text at its last mark has hash @p hash.
+  */
+  static bool read(const std::string &name, size_t hash, std::vector<record_t> *records,
+                   size_t *mark);
+
+  /** Create a new, empty journal @p name, replacing any existing file.
+      @return The journal, or @c nullptr if the file could not be created. In that case the
+          @c errno value is stored in @p error. */
+  static std::unique_ptr<undo_journal_t> create(const std::string &name, int *error);
+
+  /** Wait for all entries to be written, and close the journal. */
+  ~undo_journal_t();
+
+  /** Add an undo record at the end of the list of records. */
+  void add_record(undo_type_t type, text_coordinate_t start, string_view text);
+  /** Discard all records after the first @p size records. */
+  void truncate(size_t size);
+  /** Add a mark after the first @p position records, for text with hash @p hash. */
+  void set_mark(size_t position, size_t hash);
+
+ private:
+  explicit undo_journal_t(std::FILE *_file);
+
+  void write_entries();
+  void queue(const std::string &data);
+
+  std::FILE *file;
+  std::thread writer;
+  std::mutex lock;
+  std::condition_variable cond;
+  /* Encoded entries not yet taken by the writer. */
+  std::string pending;
+  bool stop = false;
+  /* Set by the writer after a write error, after which nothing is written anymore. */
+  bool failed = false;
+  /* Buffer for encoding an entry, only used by the thread making the changes. */
+  std::string entry;
+};
+
+}  // namespace t3widget
+#endif
@@ -225,8 +225,8 @@ class propagate_const {
 
   propagate_const &operator=(const propagate_const &) = delete;
 
-  element_type *get() { t_.get(); }
-  const element_type *get() const { t_.get(); }
+  element_type *get() { return t_.get(); }
+  const element_type *get() const { return t_.get(); }
   explicit operator bool() const { return static_cast<bool>(t_); }
 
   element_type &operator*() { return *t_.get(); }
@@ -305,7 +305,8 @@ enum {
   ANCHOR_WORD_LEFT = (1 << 5),
   ANCHOR_WORD_RIGHT = (1 << 6),
   VALID = (1 << 7),
-  REPLACEMENT_VALID = (1 << 8)
+  REPLACEMENT_VALID = (1 << 8),
+  MULTILINE = (1 << 9)
 };
 }  // namespace find_flags_t
 
@@ -337,7 +338,14 @@ enum class attribute_t {
   META_TEXT
 };
 
-enum class rewrap_type_t { REWRAP_ALL, REWRAP_LINE, REWRAP_LINE_LOCAL, INSERT_LINES, DELETE_LINES };
+enum class rewrap_type_t {
+  REWRAP_ALL,
+  REWRAP_LINE,
+  REWRAP_LINE_LOCAL,
+  INSERT_LINES,
+  DELETE_LINES,
+  REWRAP_LINES
+};
 
 enum class wrap_type_t { NONE, WORD, CHARACTER };
 
@@ -20,6 +20,7 @@
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "t3widget/autocompleter.h"
 #include "t3widget/clipboard.h"
@@ -93,6 +94,46 @@ class T3_WIDGET_LOCAL edit_window_t::autocomplete_panel_t : public popup_t {
   void connect_activate(std::function<void()> func);
 };
 
+namespace {
+
+/* Set of text lines that need to be repainted. Only the lines that actually changed are recorded,
+   such that for example moving the cursor over a large distance only repaints two lines. */
+class line_damage_t {
+ public:
+  line_damage_t() { add(0, std::numeric_limits<text_pos_t>::max()); }
+
+  /* Add the lines first up to and including last. */
+  void add(text_pos_t first, text_pos_t last) {
+    /* Find the ranges that overlap with or are adjacent to the new range, and merge them. */
+    std::vector<range_t>::iterator begin = std::lower_bound(
+        ranges_.begin(), ranges_.end(), first,
+        [](const range_t &range, text_pos_t line) { return range.second < line - 1; });
+    std::vector<range_t>::iterator end = begin;
+    for (; end != ranges_.end() && end->first - 1 <= last; ++end) {
+      first = std::min(first, end->first);
+      last = std::max(last, end->second);
+    }
+    ranges_.insert(ranges_.erase(begin, end), range_t(first, last));
+  }
+
+  bool contains(text_pos_t line) const {
+    std::vector<range_t>::const_iterator iter = std::upper_bound(
+        ranges_.begin(), ranges_.end(), line,
+        [](text_pos_t value, const range_t &range) { return value < range.first; });
+    return iter != ranges_.begin() && (iter - 1)->second >= line;
+  }
+
+  /* Remove all lines, except line. */
+  void reset(text_pos_t line) { ranges_.assign(1, range_t(line, line)); }
+
+ private:
+  typedef std::pair<text_pos_t, text_pos_t> range_t;
+  /* Sorted, disjoint and non-adjacent ranges of lines. */
+  std::vector<range_t> ranges_;
+};
+
+}  // namespace
+
 struct edit_window_t::implementation_t {
   t3window::window_t edit_window, /**< Window containing the text. */
       indicator_window; /**< Window holding the line, column, modified, etc. information line at
@@ -130,8 +171,9 @@ struct edit_window_t::implementation_t {
   std::unique_ptr<autocomplete_panel_t>
       autocomplete_panel; /**< Panel for showing autocomplete options. */
 
-  text_pos_t repaint_min = 0,                               /**< First line to repaint. */
-      repaint_max = std::numeric_limits<text_pos_t>::max(); /**< Last line to repaint. */
+  line_damage_t damage; /**< Lines to repaint. */
+  text_coordinate_t painted_selection_start{0, -1}, /**< Start of the selection as last painted. */
+      painted_selection_end{0, -1};                 /**< End of the selection as last painted. */
 };
 
 void edit_window_t::init(bool _init) {
@@ -320,6 +362,29 @@ void edit_window_t::repaint_screen() {
     current_end = text->get_selection_start();
   }
 
+  /* Repaint the lines of which the selection state changed since the last paint. An empty
+     selection covers no lines at all, so only the non-empty one of the two needs repainting. */
+  const text_coordinate_t &painted_start = impl->painted_selection_start;
+  const text_coordinate_t &painted_end = impl->painted_selection_end;
+  if (painted_start == painted_end) {
+    if (current_start != current_end) {
+      impl->damage.add(current_start.line, current_end.line);
+    }
+  } else if (current_start == current_end) {
+    impl->damage.add(painted_start.line, painted_end.line);
+  } else {
+    if (painted_start != current_start) {
+      impl->damage.add(std::min(painted_start.line, current_start.line),
+                       std::max(painted_start.line, current_start.line));
+    }
+    if (painted_end != current_end) {
+      impl->damage.add(std::min(painted_end.line, current_end.line),
+                       std::max(painted_end.line, current_end.line));
+    }
+  }
+  impl->painted_selection_start = current_start;
+  impl->painted_selection_end = current_end;
+
   info.size = impl->edit_window.get_width();
   info.tabsize = impl->tabsize;
   info.normal_attr = 0;
@@ -333,8 +398,7 @@ void edit_window_t::repaint_screen() {
 
     for (i = 0; i < impl->edit_window.get_height() && (i + impl->top_left.line) < text->size();
          i++) {
-      if (impl->top_left.line + i < impl->repaint_min ||
-          impl->top_left.line + i > impl->repaint_max) {
+      if (!impl->damage.contains(impl->top_left.line + i)) {
         continue;
       }
 
@@ -362,7 +426,7 @@ void edit_window_t::repaint_screen() {
     info.leftcol = 0;
 
     for (i = 0; i < impl->edit_window.get_height(); i++, impl->wrap_info->add_lines(draw_line, 1)) {
-      if (draw_line.line < impl->repaint_min || draw_line.line > impl->repaint_max) {
+      if (!impl->damage.contains(draw_line.line)) {
         continue;
       }
       info.selection_start = draw_line.line == current_start.line ? current_start.pos : -1;
@@ -394,8 +458,8 @@ void edit_window_t::repaint_screen() {
   impl->edit_window.set_paint(i, 0);
   impl->edit_window.clrtobot();
 
-  impl->repaint_min = cursor.line;
-  impl->repaint_max = cursor.line;
+  /* The cursor line needs to be repainted when the cursor moves away from it. */
+  impl->damage.reset(cursor.line);
 }
 
 void edit_window_t::inc_x() {
@@ -782,27 +846,14 @@ void edit_window_t::find_activated(std::shared_ptr<finder_t> _finder, find_actio
       replace_buttons->reshow(action);
       break;
     case find_action_t::REPLACE_ALL: {
-      int replacements;
       text_coordinate_t start(0, -1);
       text_coordinate_t eof(std::numeric_limits<text_pos_t>::max(),
                             std::numeric_limits<text_pos_t>::max());
 
-      for (replacements = 0; text->find_limited(local_finder, start, eof, &result);
-           replacements++) {
-        lprintf("Find result: %ld %ld\n", result.start.line, result.start.pos);
-        if (replacements == 0) {
-          text->start_undo_block();
-        }
-        text->replace(*local_finder, result);
-        start = text->get_cursor();
-        lprintf("New start: %ld %ld\n", start.line, start.pos);
-      }
-
-      if (replacements == 0) {
+      if (text->replace_all(local_finder, start, eof) == 0) {
         goto not_found;
       }
 
-      text->end_undo_block();
       reset_selection();
       ensure_cursor_on_screen();
       update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
@@ -815,9 +866,6 @@ void edit_window_t::find_activated(std::shared_ptr<finder_t> _finder, find_actio
 
       text_coordinate_t start(text->get_selection_start());
       text_coordinate_t end(text->get_selection_end());
-      text_coordinate_t saved_start;
-      int replacements;
-      text_pos_t end_line_length;
       bool reverse_selection = false;
 
       if (end < start) {
@@ -825,34 +873,19 @@ void edit_window_t::find_activated(std::shared_ptr<finder_t> _finder, find_actio
         end = text->get_selection_start();
         reverse_selection = true;
       }
-      end_line_length = text->get_line_size(end.line);
-      saved_start = start;
 
-      for (replacements = 0; text->find_limited(local_finder, start, end, &result);
-           replacements++) {
-        if (replacements == 0) {
-          text->start_undo_block();
-        }
-        text->replace(*local_finder, result);
-        start = text->get_cursor();
-        end.pos -= end_line_length - text->get_line_size(end.line);
-        end_line_length = text->get_line_size(end.line);
-      }
-
-      if (replacements == 0) {
+      if (text->replace_all(local_finder, start, end) == 0) {
         goto not_found;
       }
 
-      text->end_undo_block();
-
       text->set_selection_mode(selection_mode_t::NONE);
       if (reverse_selection) {
         text->set_cursor(end);
         text->set_selection_mode(selection_mode_t::SHIFT);
-        text->set_cursor(saved_start);
+        text->set_cursor(start);
         text->set_selection_end();
       } else {
-        text->set_cursor(saved_start);
+        text->set_cursor(start);
         text->set_selection_mode(selection_mode_t::SHIFT);
         text->set_cursor(end);
         text->set_selection_end();
@@ -1083,6 +1116,9 @@ bool edit_window_t::process_key(key_t key) {
         text->end_undo_block();
       }
       break;
+    case EKEY_PASTE:
+      insert_text(get_pasted_text());
+      break;
     default: {
       int local_insmode;
 
@@ -1213,11 +1249,7 @@ void edit_window_t::update_contents() {
         std::max(text->size(), impl->top_left.line + impl->edit_window.get_height()),
         impl->top_left.line, impl->edit_window.get_height());
   } else {
-    text_pos_t count = 0;
-    for (text_pos_t i = 0; i < impl->top_left.line; i++) {
-      count += impl->wrap_info->get_line_count(i);
-    }
-    count += impl->top_left.pos;
+    text_pos_t count = impl->wrap_info->get_wrapped_pos(impl->top_left);
 
     impl->scrollbar->set_parameters(
         std::max(impl->wrap_info->wrapped_size(), count + impl->edit_window.get_height()), count,
@@ -1289,28 +1321,30 @@ void edit_window_t::paste() { paste(true); }
 void edit_window_t::paste_selection() { paste(false); }
 
 void edit_window_t::paste(bool clipboard) {
-  {
-    ensure_clipboard_lock_t lock;
-    std::shared_ptr<std::string> copy_buffer = clipboard ? get_clipboard() : get_primary();
-    if (copy_buffer != nullptr) {
-      if (text->get_selection_mode() == selection_mode_t::NONE) {
-        update_repaint_lines(text->get_cursor().line, std::numeric_limits<text_pos_t>::max());
-        text->insert_block(*copy_buffer);
-      } else {
-        text_coordinate_t current_start;
-        text_coordinate_t current_end;
-        current_start = text->get_selection_start();
-        current_end = text->get_selection_end();
-        update_repaint_lines(
-            current_start.line < current_end.line ? current_start.line : current_end.line,
-            std::numeric_limits<text_pos_t>::max());
-        text->replace_block(current_start, current_end, *copy_buffer);
-        reset_selection();
-      }
-      ensure_cursor_on_screen();
-      impl->last_set_pos = impl->screen_pos;
-    }
+  ensure_clipboard_lock_t lock;
+  std::shared_ptr<std::string> copy_buffer = clipboard ? get_clipboard() : get_primary();
+  if (copy_buffer != nullptr) {
+    insert_text(*copy_buffer);
+  }
+}
+
+void edit_window_t::insert_text(const std::string &str) {
+  if (text->get_selection_mode() == selection_mode_t::NONE) {
+    update_repaint_lines(text->get_cursor().line, std::numeric_limits<text_pos_t>::max());
+    text->insert_block(str);
+  } else {
+    text_coordinate_t current_start;
+    text_coordinate_t current_end;
+    current_start = text->get_selection_start();
+    current_end = text->get_selection_end();
+    update_repaint_lines(
+        current_start.line < current_end.line ? current_start.line : current_end.line,
+        std::numeric_limits<text_pos_t>::max());
+    text->replace_block(current_start, current_end, str);
+    reset_selection();
   }
+  ensure_cursor_on_screen();
+  impl->last_set_pos = impl->screen_pos;
 }
 
 void edit_window_t::right_click_menu_activated(int action) {
@@ -1478,7 +1512,10 @@ void edit_window_t::set_tabsize(int _tabsize) {
   }
   impl->tabsize = _tabsize;
   if (impl->wrap_info != nullptr) {
+    impl->top_left.pos =
+        impl->wrap_info->calculate_line_pos(impl->top_left.line, 0, impl->top_left.pos);
     impl->wrap_info->set_tabsize(impl->tabsize);
+    impl->top_left.pos = impl->wrap_info->find_line(impl->top_left);
   }
   force_redraw();
 }
@@ -1654,16 +1691,9 @@ void edit_window_t::activate_autocomplete(bool autocomplete_single) {
     } else {
       text_pos_t sub_line = impl->wrap_info->find_line(cursor);
       text_pos_t position = impl->wrap_info->calculate_screen_pos(anchor);
-      text_pos_t line;
-
-      if (cursor.line == impl->top_left.line) {
-        line = sub_line - impl->top_left.pos;
-      } else {
-        line = impl->wrap_info->get_line_count(impl->top_left.line) - impl->top_left.pos + sub_line;
-        for (text_pos_t i = impl->top_left.line + 1; i < cursor.line; i++) {
-          line += impl->wrap_info->get_line_count(i);
-        }
-      }
+      text_pos_t line =
+          impl->wrap_info->get_wrapped_pos(text_coordinate_t(cursor.line, sub_line)) -
+          impl->wrap_info->get_wrapped_pos(impl->top_left);
       impl->autocomplete_panel->set_position(line + 1, position - 1);
     }
     impl->autocomplete_panel->show();
@@ -1770,25 +1800,12 @@ void edit_window_t::scrollbar_dragged(text_pos_t start) {
       update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
     }
   } else {
-    text_coordinate_t new_top_left(0, 0);
-    text_pos_t count = 0;
-
     if (start < 0 || start + impl->edit_window.get_height() > impl->wrap_info->wrapped_size()) {
       return;
     }
 
-    for (new_top_left.line = 0; new_top_left.line < text->size() && count < start;
-         new_top_left.line++) {
-      count += impl->wrap_info->get_line_count(new_top_left.line);
-    }
-
-    if (count > start) {
-      new_top_left.line--;
-      count -= impl->wrap_info->get_line_count(new_top_left.line);
-      new_top_left.pos = start - count;
-    }
-
-    if (new_top_left == impl->top_left || new_top_left.line < 0) {
+    text_coordinate_t new_top_left = impl->wrap_info->get_wrapped_coordinate(start);
+    if (new_top_left == impl->top_left) {
       return;
     }
     impl->top_left = new_top_left;
@@ -1805,12 +1822,7 @@ void edit_window_t::update_repaint_lines(text_pos_t start, text_pos_t end) {
     end = tmp;
   }
 
-  if (start < impl->repaint_min) {
-    impl->repaint_min = start;
-  }
-  if (end > impl->repaint_max) {
-    impl->repaint_max = end;
-  }
+  impl->damage.add(start, end);
   widget_t::force_redraw();
 }
 
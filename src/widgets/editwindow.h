@@ -113,6 +113,8 @@ class T3_WIDGET_API edit_window_t : public widget_t,
   void mark_selection();
   /** Pastes either the selection, or the clipboard. */
   void paste(bool clipboard);
+  /** Insert @p str at the cursor, replacing the selection if there is one. */
+  void insert_text(const std::string &str);
 
   void right_click_menu_activated(int action);
 
@@ -321,6 +321,10 @@ bool text_field_t::process_key(key_t key) {
     case EKEY_HOTKEY:
       return true;
 
+    case EKEY_PASTE:
+      insert_text(get_pasted_text());
+      break;
+
     default: {
       optional<Action> action = key_bindings.find_action(key);
       if (action.is_valid()) {
@@ -355,34 +359,7 @@ bool text_field_t::process_key(key_t key) {
             std::shared_ptr<std::string> copy_buffer =
                 action.value() == ACTION_PASTE ? get_clipboard() : get_primary();
             if (copy_buffer != nullptr) {
-              std::unique_ptr<text_line_t> insert_line(new text_line_t(*copy_buffer));
-
-              // Don't allow pasting of values that do not match the filter
-              if (impl->filter_keys != nullptr) {
-                const std::string &insert_data = insert_line->get_data();
-                size_t insert_data_length = insert_data.size();
-                size_t bytes_read;
-                do {
-                  key_t c;
-                  bytes_read = insert_data_length;
-                  c = t3_utf8_get(insert_data.data() + insert_data.size() - insert_data_length,
-                                  &bytes_read);
-                  if ((std::find(impl->filter_keys, impl->filter_keys + impl->filter_keys_size,
-                                 c) == impl->filter_keys + impl->filter_keys_size) ==
-                      impl->filter_keys_accept)
-                    return true;
-                  insert_data_length -= bytes_read;
-                } while (insert_data_length > 0 && bytes_read > 0);
-              }
-
-              if (impl->selection_mode != selection_mode_t::NONE) delete_selection(false);
-
-              text_pos_t cursor_move = insert_line->size();
-              impl->line->insert(std::move(insert_line), impl->pos);
-              impl->pos += cursor_move;
-              ensure_cursor_on_screen();
-              force_redraw();
-              impl->edited = true;
+              insert_text(*copy_buffer);
             }
             return true;
           }
@@ -459,6 +436,35 @@ bool text_field_t::process_key(key_t key) {
   return true;
 }
 
+void text_field_t::insert_text(const std::string &str) {
+  std::unique_ptr<text_line_t> insert_line(new text_line_t(str));
+
+  // Don't allow pasting of values that do not match the filter
+  if (impl->filter_keys != nullptr) {
+    const std::string &insert_data = insert_line->get_data();
+    size_t insert_data_length = insert_data.size();
+    size_t bytes_read;
+    do {
+      key_t c;
+      bytes_read = insert_data_length;
+      c = t3_utf8_get(insert_data.data() + insert_data.size() - insert_data_length, &bytes_read);
+      if ((std::find(impl->filter_keys, impl->filter_keys + impl->filter_keys_size, c) ==
+           impl->filter_keys + impl->filter_keys_size) == impl->filter_keys_accept)
+        return;
+      insert_data_length -= bytes_read;
+    } while (insert_data_length > 0 && bytes_read > 0);
+  }
+
+  if (impl->selection_mode != selection_mode_t::NONE) delete_selection(false);
+
+  text_pos_t cursor_move = insert_line->size();
+  impl->line->insert(std::move(insert_line), impl->pos);
+  impl->pos += cursor_move;
+  ensure_cursor_on_screen();
+  force_redraw();
+  impl->edited = true;
+}
+
 bool text_field_t::set_size(optint height, optint width) {
   (void)height;
   if (width.is_valid() && window.get_width() != width.value()) {
@@ -49,6 +49,9 @@ class T3_WIDGET_API text_field_t : public widget_t,
   void set_selection(key_t key);
   /** Delete the current selection. */
   void delete_selection(bool save_to_copy_buffer);
+  /** Insert @p str at the cursor, replacing the selection if there is one.
+      Nothing is inserted if @p str contains characters rejected by the key filter. */
+  void insert_text(const std::string &str);
   /** Make sure the text in the text_field_t is aligned such that the cursor is visible. */
   void ensure_cursor_on_screen();
 
@@ -40,8 +40,12 @@ struct text_window_t::implementation_t {
   text_coordinate_t top;
   signal_t<> activate;
   bool focus;
+  /* Whether all rows must be repainted. If not, only the first row is repainted, as long as the
+     text has not been scrolled since it was last painted. */
+  bool repaint_all;
+  text_coordinate_t painted_top;
 
-  implementation_t() : top(0, 0), focus(false) {}
+  implementation_t() : top(0, 0), focus(false), repaint_all(true), painted_top(0, 0) {}
 };
 
 text_window_t::text_window_t(text_buffer_t *_text, bool with_scrollbar)
@@ -197,6 +201,14 @@ void text_window_t::update_contents() {
     return;
   }
 
+  /* A change of focus only changes the cursor, which is drawn in the first row. Scrolling moves
+     the contents of all rows, which libt3window has no means of moving, so then all rows are
+     repainted. */
+  const bool repaint_all = impl->repaint_all || impl->top != impl->painted_top;
+  const int rows = repaint_all ? window.get_height() : std::min(1, window.get_height());
+  impl->repaint_all = false;
+  impl->painted_top = impl->top;
+
   window.set_default_attrs(attributes.dialog);
 
   info.size = window.get_width();
@@ -214,7 +226,7 @@ void text_window_t::update_contents() {
   text_coordinate_t end = impl->wrap_info->get_end();
   text_coordinate_t draw_line = impl->top;
 
-  for (int i = 0; i < window.get_height(); i++, impl->wrap_info->add_lines(draw_line, 1)) {
+  for (int i = 0; i < rows; i++, impl->wrap_info->add_lines(draw_line, 1)) {
     if (impl->focus) {
       if (i == 0) {
         info.cursor = impl->wrap_info->calculate_line_pos(draw_line.line, 0, draw_line.pos);
@@ -231,13 +243,11 @@ void text_window_t::update_contents() {
     }
   }
 
-  window.clrtobot();
-
-  text_pos_t count = 0;
-  for (text_pos_t i = 0; i < impl->top.line; i++) {
-    count += impl->wrap_info->get_line_count(i);
+  if (repaint_all) {
+    window.clrtobot();
   }
-  count += impl->top.pos;
+
+  text_pos_t count = impl->wrap_info->get_wrapped_pos(impl->top);
 
   if (impl->scrollbar != nullptr) {
     impl->scrollbar->set_parameters(
@@ -249,11 +259,16 @@ void text_window_t::update_contents() {
 
 void text_window_t::set_focus(focus_t _focus) {
   if (impl->focus != _focus) {
-    force_redraw();
+    widget_t::force_redraw();
   }
   impl->focus = _focus;
 }
 
+void text_window_t::force_redraw() {
+  impl->repaint_all = true;
+  widget_t::force_redraw();
+}
+
 void text_window_t::set_child_focus(window_component_t *target) {
   (void)target;
   set_focus(window_component_t::FOCUS_SET);
@@ -303,25 +318,12 @@ void text_window_t::scrollbar_clicked(scrollbar_t::step_t step) {
 }
 
 void text_window_t::scrollbar_dragged(text_pos_t start) {
-  text_coordinate_t new_top_left(0, 0);
-  text_pos_t count = 0;
-
   if (start < 0 || start + window.get_height() > impl->wrap_info->wrapped_size()) {
     return;
   }
 
-  for (new_top_left.line = 0; new_top_left.line < impl->text->size() && count < start;
-       new_top_left.line++) {
-    count += impl->wrap_info->get_line_count(new_top_left.line);
-  }
-
-  if (count > start) {
-    new_top_left.line--;
-    count -= impl->wrap_info->get_line_count(new_top_left.line);
-    new_top_left.pos = start - count;
-  }
-
-  if (new_top_left == impl->top || new_top_left.line < 0) {
+  text_coordinate_t new_top_left = impl->wrap_info->get_wrapped_coordinate(start);
+  if (new_top_left == impl->top) {
     return;
   }
   impl->top = new_top_left;
@@ -43,6 +43,7 @@ class T3_WIDGET_API text_window_t : public widget_t, public center_component_t,
   void set_child_focus(window_component_t *target) override;
   bool is_child(const window_component_t *component) const override;
   bool process_mouse_event(mouse_event_t event) override;
+  void force_redraw() override;
 
   void set_scrollbar(bool with_scrollbar);
   void set_text(text_buffer_t *text);
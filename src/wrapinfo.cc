@@ -14,11 +14,15 @@
 
 #include "t3widget/wrapinfo.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <limits>
 #include <memory>
+#include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "t3widget/internal.h"
 #include "t3widget/log.h"
@@ -28,79 +32,276 @@
 
 namespace t3widget {
 
-wrap_info_t::wrap_info_t(int width, int _tabsize)
-    : text(nullptr), tabsize(_tabsize), wrap_width(width), size(0) {}
+/* Texts with at most this number of lines are wrapped completely when the settings change. Larger
+   texts are only wrapped as the lines are needed. */
+static const size_t eager_wrap_limit = 65536;
+/* Number of lines handed to a worker at a time in wrap_all. */
+static const size_t block_size = 2048;
+/* Upper limit on the number of threads used by wrap_all. */
+static const unsigned max_workers = 8;
+
+/* Append the wrap points after start in line to points. */
+static void find_wrap_points(const text_line_t &line, int wrap_width, int tabsize, text_pos_t start,
+                             wrap_points_t *points) {
+  text_line_t::break_pos_t break_pos;
 
-wrap_info_t::~wrap_info_t() {
-  rewrap_connection.disconnect();
-  for (wrap_points_t *iter : wrap_data) {
-    delete iter;
+  while (true) {
+    break_pos = line.find_next_break_pos(start, wrap_width - 1, tabsize);
+    if (break_pos.pos > 0) {
+      points->push_back(break_pos.pos);
+      start = break_pos.pos;
+    } else {
+      break;
+    }
   }
 }
 
+wrap_info_t::wrap_info_t(int width, int _tabsize)
+    : text(nullptr),
+      tabsize(_tabsize),
+      wrap_width(width),
+      size(0),
+      generation(1),
+      line_count_tree_valid(false) {}
+
+wrap_info_t::~wrap_info_t() { rewrap_connection.disconnect(); }
+
 text_pos_t wrap_info_t::unwrapped_size() const { return wrap_data.size(); }
 text_pos_t wrap_info_t::wrapped_size() const { return size; }
 
+text_pos_t wrap_info_t::stored_line_count(text_pos_t line) const {
+  uint32_t points = wrap_data[line].points;
+  return points == 0 ? 1 : static_cast<text_pos_t>(extra_points[points - 1].size()) + 1;
+}
+
+text_pos_t wrap_info_t::wrap_point(text_pos_t line, text_pos_t index) const {
+  return index == 0 ? 0 : extra_points[wrap_data[line].points - 1][index - 1];
+}
+
+uint32_t wrap_info_t::allocate_points(wrap_points_t *points) const {
+  uint32_t idx;
+  if (free_points.empty()) {
+    idx = extra_points.size();
+    extra_points.emplace_back();
+  } else {
+    idx = free_points.back();
+    free_points.pop_back();
+  }
+  extra_points[idx].swap(*points);
+  return idx + 1;
+}
+
+void wrap_info_t::release_points(wrap_line_t *data) const {
+  if (data->points == 0) {
+    return;
+  }
+  wrap_points_t().swap(extra_points[data->points - 1]);
+  free_points.push_back(data->points - 1);
+  data->points = 0;
+}
+
 void wrap_info_t::delete_lines(text_pos_t first, text_pos_t last) {
-  for (wrap_data_t::iterator iter = wrap_data.begin() + first; iter != wrap_data.begin() + last;
-       iter++) {
-    size -= (*iter)->size();
-    delete *iter;
+  for (text_pos_t i = first; i < last; i++) {
+    size -= stored_line_count(i);
+    release_points(&wrap_data[i]);
   }
   wrap_data.erase(wrap_data.begin() + first, wrap_data.begin() + last);
+  line_count_tree_valid = false;
 }
 
 void wrap_info_t::insert_lines(text_pos_t first, text_pos_t last) {
-  text_pos_t i;
-  for (i = first; i < last; i++) {
-    wrap_data.insert(wrap_data.begin() + i, new wrap_points_t());
-    // Ensure that the list of break positions contains at least the start position.
-    wrap_data[i]->push_back(0);
-    size++;
-    rewrap_line(i, 0, true);
-  }
+  /* The new lines are only wrapped when they are needed. Until then, they are counted as a single
+     sub-line. */
+  wrap_line_t new_line = {0, 0};
+  wrap_data.insert(wrap_data.begin() + first, last - first, new_line);
+  line_count_tree_valid = false;
+  size += last - first;
 }
 
 void wrap_info_t::rewrap_line(text_pos_t line, text_pos_t pos, bool local) {
   text_line_t::break_pos_t break_pos;
-  size_t i;
+  text_pos_t i;
 
-  /* The list of break positions always contains the start position (0). */
+  if (wrap_data[line].generation != generation) {
+    wrap_line(line, 0);
+    return;
+  }
 
-  for (i = wrap_data[line]->size() - 1; i > 0 && (*wrap_data[line])[i] > pos; i--) {
+  const text_pos_t line_count = stored_line_count(line);
+  for (i = line_count - 1; i > 0 && wrap_point(line, i) > pos; i--) {
   }
 
   if (local) {
-    break_pos = text->impl->lines[line]->find_next_break_pos((*wrap_data[line])[i], wrap_width - 1,
+    break_pos = text->impl->lines[line]->find_next_break_pos(wrap_point(line, i), wrap_width - 1,
                                                              tabsize);
-    if (i < wrap_data[line]->size() - 1 && break_pos.pos == (*wrap_data[line])[i + 1]) {
+    if (i < line_count - 1 && break_pos.pos == wrap_point(line, i + 1)) {
       return;
     }
   }
 
-  /* Keep it simple: subtract the full size here, and add the full size again
-     when we are done rewrapping. */
-  size -= wrap_data[line]->size();
-  wrap_data[line]->erase(wrap_data[line]->begin() + i + 1, wrap_data[line]->end());
+  wrap_line(line, i);
+}
 
-  while (true) {
-    break_pos = text->impl->lines[line]->find_next_break_pos(wrap_data[line]->back(),
-                                                             wrap_width - 1, tabsize);
-    if (break_pos.pos > 0) {
-      wrap_data[line]->push_back(break_pos.pos);
-    } else {
-      break;
+void wrap_info_t::wrap_line(text_pos_t line, size_t index) const {
+  wrap_line_t &data = wrap_data[line];
+  const text_pos_t old_line_count = stored_line_count(line);
+  const text_line_t &line_data = *text->impl->lines[line];
+
+  if (data.points == 0) {
+    wrap_points_t points;
+    find_wrap_points(line_data, wrap_width, tabsize, 0, &points);
+    if (!points.empty()) {
+      data.points = allocate_points(&points);
+    }
+  } else {
+    wrap_points_t &points = extra_points[data.points - 1];
+    points.erase(points.begin() + index, points.end());
+    find_wrap_points(line_data, wrap_width, tabsize, index == 0 ? 0 : points.back(), &points);
+    if (points.empty()) {
+      release_points(&data);
+    }
+  }
+  data.generation = generation;
+
+  const text_pos_t new_line_count = stored_line_count(line);
+  if (new_line_count != old_line_count) {
+    size += new_line_count - old_line_count;
+    update_line_count(line, new_line_count - old_line_count);
+  }
+}
+
+void wrap_info_t::ensure_wrapped(text_pos_t line) const {
+  if (wrap_data[line].generation != generation) {
+    wrap_line(line, 0);
+  }
+}
+
+void wrap_info_t::update_line_count(text_pos_t line, text_pos_t change) const {
+  if (!line_count_tree_valid) {
+    return;
+  }
+  const size_t tree_size = line_count_tree.size();
+  for (size_t i = line + 1; i < tree_size; i += i & -i) {
+    line_count_tree[i] += change;
+  }
+}
+
+void wrap_info_t::build_line_count_tree() const {
+  const size_t tree_size = wrap_data.size() + 1;
+  line_count_tree.resize(tree_size);
+  line_count_tree[0] = 0;
+  for (size_t i = 1; i < tree_size; ++i) {
+    line_count_tree[i] = stored_line_count(i - 1);
+  }
+  /* Linear time construction: add each node to its parent. */
+  for (size_t i = 1; i < tree_size; ++i) {
+    size_t parent = i + (i & -i);
+    if (parent < tree_size) {
+      line_count_tree[parent] += line_count_tree[i];
     }
   }
-  size += wrap_data[line]->size();
+  line_count_tree_valid = true;
 }
 
 void wrap_info_t::rewrap_all() {
-  for (size_t i = 0; i < wrap_data.size(); i++) {
-    rewrap_line(i, 0, false);
+  /* Only mark all lines as out of date. The current line counts remain as estimates. */
+  if (++generation == 0) {
+    for (wrap_line_t &data : wrap_data) {
+      data.generation = 0;
+    }
+    generation = 1;
+  }
+  if (wrap_data.size() <= eager_wrap_limit) {
+    wrap_all();
   }
 }
 
+void wrap_info_t::wrap_all() {
+  std::vector<text_pos_t> todo;
+  /* Retrieving a line may load it in the line store, which can not be done from the workers. */
+  std::vector<const text_line_t *> lines;
+  for (size_t i = 0; i < wrap_data.size(); ++i) {
+    if (wrap_data[i].generation != generation) {
+      todo.push_back(i);
+      lines.push_back(text->impl->lines[i].get());
+    }
+  }
+  if (todo.empty()) {
+    return;
+  }
+
+  unsigned worker_count = std::thread::hardware_concurrency();
+  worker_count = std::max(1u, std::min(worker_count, max_workers));
+  worker_count = std::min<size_t>(worker_count, (todo.size() + block_size - 1) / block_size);
+
+  /* Each worker handles whole blocks of lines, and keeps track of the change in the number of
+     sub-lines of those lines. Lines that already have an entry in extra_points are updated in
+     place. Allocating and releasing entries is left to the calling thread, after all workers are
+     done. */
+  struct worker_result_t {
+    text_pos_t size_change;
+    std::vector<std::pair<text_pos_t, wrap_points_t>> new_points;
+    std::vector<text_pos_t> emptied;
+  };
+  std::atomic<size_t> next_block(0);
+  std::vector<worker_result_t> results(worker_count);
+  auto work = [&](unsigned worker) {
+    worker_result_t &result = results[worker];
+    wrap_points_t points;
+    result.size_change = 0;
+    while (true) {
+      size_t first = next_block++ * block_size;
+      if (first >= todo.size()) {
+        break;
+      }
+      size_t last = std::min(first + block_size, todo.size());
+      for (size_t i = first; i < last; ++i) {
+        wrap_line_t &data = wrap_data[todo[i]];
+        result.size_change -= stored_line_count(todo[i]);
+        if (data.points == 0) {
+          find_wrap_points(*lines[i], wrap_width, tabsize, 0, &points);
+          if (!points.empty()) {
+            result.size_change += points.size();
+            result.new_points.emplace_back(todo[i], std::move(points));
+            points.clear();
+          }
+        } else {
+          wrap_points_t &line_points = extra_points[data.points - 1];
+          line_points.clear();
+          find_wrap_points(*lines[i], wrap_width, tabsize, 0, &line_points);
+          result.size_change += line_points.size();
+          if (line_points.empty()) {
+            result.emptied.push_back(todo[i]);
+          }
+        }
+        result.size_change += 1;
+        data.generation = generation;
+      }
+    }
+  };
+
+  /* The calling thread is the first worker. */
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < worker_count; ++i) {
+    workers.emplace_back(work, i);
+  }
+  work(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  for (worker_result_t &result : results) {
+    size += result.size_change;
+    for (text_pos_t line : result.emptied) {
+      release_points(&wrap_data[line]);
+    }
+    for (std::pair<text_pos_t, wrap_points_t> &new_points : result.new_points) {
+      wrap_data[new_points.first].points = allocate_points(&new_points.second);
+    }
+  }
+  line_count_tree_valid = false;
+}
+
 void wrap_info_t::set_wrap_width(int width) {
   lprintf("Setting wrap width: %d\n", width);
   if (width == wrap_width) {
@@ -132,17 +333,15 @@ void wrap_info_t::set_text_buffer(text_buffer_t *_text) {
 
   rewrap_connection = text->connect_rewrap_required(bind_front(&wrap_info_t::rewrap, this));
 
-  if (wrap_data.size() > text->impl->lines.size()) {
+  if (static_cast<text_pos_t>(wrap_data.size()) > text->impl->lines.size()) {
     delete_lines(text->impl->lines.size(), wrap_data.size());
   }
 
-  for (size_t i = 0; i < wrap_data.size(); i++) {
-    rewrap_line(i, 0, false);
-  }
-
-  if (wrap_data.size() < text->impl->lines.size()) {
+  if (static_cast<text_pos_t>(wrap_data.size()) < text->impl->lines.size()) {
     insert_lines(wrap_data.size(), text->impl->lines.size());
   }
+
+  rewrap_all();
 }
 
 void wrap_info_t::rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b) {
@@ -162,6 +361,11 @@ void wrap_info_t::rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b) {
     case rewrap_type_t::DELETE_LINES:
       delete_lines(a, b);
       break;
+    case rewrap_type_t::REWRAP_LINES:
+      for (text_pos_t i = a; i < b; ++i) {
+        rewrap_line(i, 0, false);
+      }
+      break;
     default:
       ASSERT(false);
   }
@@ -170,14 +374,14 @@ void wrap_info_t::rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b) {
 bool wrap_info_t::add_lines(text_coordinate_t &coord, text_pos_t count) const {
   ASSERT(count > 0);
   while (static_cast<size_t>(coord.line) < wrap_data.size() &&
-         wrap_data[coord.line]->size() <= static_cast<size_t>(coord.pos + count)) {
-    count -= wrap_data[coord.line]->size() - coord.pos;
+         get_line_count(coord.line) <= coord.pos + count) {
+    count -= get_line_count(coord.line) - coord.pos;
     coord.line++;
     coord.pos = 0;
   }
   if (static_cast<size_t>(coord.line) == wrap_data.size()) {
     coord.line = wrap_data.size() - 1;
-    coord.pos = wrap_data[coord.line]->size() - 1;
+    coord.pos = get_line_count(coord.line) - 1;
     return true;
   } else {
     coord.pos += count;
@@ -193,9 +397,9 @@ bool wrap_info_t::sub_lines(text_coordinate_t &coord, text_pos_t count) const {
   }
   count -= coord.pos;
   coord.pos = 0;
-  while (coord.line > 0 && static_cast<size_t>(count) >= wrap_data[coord.line - 1]->size()) {
+  while (coord.line > 0 && count >= get_line_count(coord.line - 1)) {
     coord.line--;
-    count -= wrap_data[coord.line]->size();
+    count -= get_line_count(coord.line);
   }
   if (count == 0) {
     return false;
@@ -204,23 +408,62 @@ bool wrap_info_t::sub_lines(text_coordinate_t &coord, text_pos_t count) const {
     return true;
   }
   coord.line--;
-  coord.pos = wrap_data[coord.line]->size() - count;
+  coord.pos = get_line_count(coord.line) - count;
   return false;
 }
 
 text_pos_t wrap_info_t::get_line_count(text_pos_t line) const {
-  return static_cast<text_pos_t>(wrap_data[line]->size());
+  ensure_wrapped(line);
+  return stored_line_count(line);
+}
+
+text_pos_t wrap_info_t::get_wrapped_pos(text_coordinate_t coord) const {
+  if (!line_count_tree_valid) {
+    build_line_count_tree();
+  }
+  text_pos_t result = coord.pos;
+  for (size_t i = coord.line; i > 0; i -= i & -i) {
+    result += line_count_tree[i];
+  }
+  return result;
+}
+
+text_coordinate_t wrap_info_t::get_wrapped_coordinate(text_pos_t pos) const {
+  if (pos >= size) {
+    return get_end();
+  }
+  if (!line_count_tree_valid) {
+    build_line_count_tree();
+  }
+
+  /* Find the last line for which the number of sub-lines before it is at most pos, by descending
+     the tree. */
+  const size_t tree_size = line_count_tree.size();
+  size_t step = 1;
+  while (step * 2 < tree_size) {
+    step *= 2;
+  }
+  size_t line = 0;
+  for (; step > 0; step /= 2) {
+    if (line + step < tree_size && line_count_tree[line + step] <= pos) {
+      line += step;
+      pos -= line_count_tree[line];
+    }
+  }
+  /* The line count used above may have been an estimate. */
+  return text_coordinate_t(line, std::min(pos, get_line_count(line) - 1));
 }
 
 text_coordinate_t wrap_info_t::get_end() const {
   text_coordinate_t result(static_cast<text_pos_t>(wrap_data.size()) - 1,
-                           static_cast<text_pos_t>(wrap_data[wrap_data.size() - 1]->size()) - 1);
+                           get_line_count(static_cast<text_pos_t>(wrap_data.size()) - 1) - 1);
   return result;
 }
 
 text_pos_t wrap_info_t::find_line(text_coordinate_t coord) const {
-  size_t i;
-  for (i = 1; i < wrap_data[coord.line]->size() && coord.pos >= (*wrap_data[coord.line])[i]; i++) {
+  text_pos_t i;
+  const text_pos_t line_count = get_line_count(coord.line);
+  for (i = 1; i < line_count && coord.pos >= wrap_point(coord.line, i); i++) {
   }
   return i - 1;
 }
@@ -231,26 +474,28 @@ text_pos_t wrap_info_t::calculate_screen_pos() const {
 
 text_pos_t wrap_info_t::calculate_screen_pos(const text_coordinate_t &where) const {
   text_pos_t sub_line = find_line(text->impl->cursor);
-  return text->impl->lines[where.line]->calculate_screen_width((*wrap_data[where.line])[sub_line],
+  ensure_wrapped(where.line);
+  return text->impl->lines[where.line]->calculate_screen_width(wrap_point(where.line, sub_line),
                                                                where.pos, tabsize);
 }
 
 text_pos_t wrap_info_t::calculate_line_pos(text_pos_t line, text_pos_t pos,
                                            text_pos_t sub_line) const {
+  ensure_wrapped(line);
   return text->impl->lines[line]->calculate_line_pos(
-      (*wrap_data[line])[sub_line],
-      static_cast<size_t>(sub_line) + 1 < wrap_data[line]->size()
-          ? (*wrap_data[line])[sub_line + 1] - 1
-          : std::numeric_limits<text_pos_t>::max(),
+      wrap_point(line, sub_line),
+      sub_line + 1 < stored_line_count(line) ? wrap_point(line, sub_line + 1) - 1
+                                          : std::numeric_limits<text_pos_t>::max(),
       pos, tabsize);
 }
 
 void wrap_info_t::paint_line(t3window::window_t *win, text_coordinate_t line,
                              text_line_t::paint_info_t &info) const {
-  info.start = (*wrap_data[line.line])[line.pos];
+  ensure_wrapped(line.line);
+  info.start = wrap_point(line.line, line.pos);
   info.flags &= ~text_line_t::BREAK;
-  if (static_cast<size_t>(line.pos) + 1 < wrap_data[line.line]->size()) {
-    info.max = (*wrap_data[line.line])[(line.pos + 1)];
+  if (line.pos + 1 < stored_line_count(line.line)) {
+    info.max = wrap_point(line.line, line.pos + 1);
     info.flags |= text_line_t::BREAK;
   } else {
     info.max = std::numeric_limits<text_pos_t>::max();
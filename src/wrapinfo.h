@@ -18,6 +18,7 @@
 #error This header file is for internal use _only_!!
 #endif
 
+#include <cstdint>
 #include <t3widget/signals.h>
 #include <t3widget/textbuffer.h>
 #include <t3widget/textline.h>
@@ -28,8 +29,17 @@
 
 namespace t3widget {
 
+/* The wrap points of a line, excluding the start of the line. */
 typedef std::vector<text_pos_t> wrap_points_t;
-typedef std::vector<wrap_points_t *> wrap_data_t;
+
+/* Wrap information of a single line. */
+struct wrap_line_t {
+  /* Generation of the settings with which the line was last wrapped. */
+  uint32_t generation;
+  /* Zero if the line consists of a single sub-line. Otherwise one more than the index of the wrap
+     points of the line in wrap_info_t::extra_points. */
+  uint32_t points;
+};
 
 /** Class holding information about wrapping a text_buffer_t.
 
@@ -38,21 +48,61 @@ typedef std::vector<wrap_points_t *> wrap_data_t;
     text_coordinate_t class in a special way: the @c pos field is used to store
     the index in the array of wrap points for the line indicated by the @c line
     field.
+
+    To quickly convert between such coordinates and the position in the wrapped
+    text, a Fenwick tree (binary indexed tree) of the number of sub-lines of each
+    line is kept. It is updated in place when a single line is rewrapped, and
+    rebuilt when it is next needed after lines were inserted or deleted.
+
+    Lines are wrapped lazily: changing the wrap width or tab size only marks all
+    lines as out of date, and newly inserted lines are not wrapped either. Such
+    lines are wrapped when they are first accessed, which in practice means when
+    they are shown on screen. Until then, their line count is an estimate: the
+    line count from the previous wrapping, or a single sub-line for new lines.
+    Therefore changing the size of a window costs time proportional to the size
+    of the window, rather than to the size of the text. Small texts are still
+    wrapped completely, using multiple threads (see wrap_all).
+
+    As most lines fit on a single sub-line, the information stored for each line
+    is kept as small as possible. Only lines with more than one sub-line use a
+    separately allocated list of wrap points.
 */
 class T3_WIDGET_LOCAL wrap_info_t {
  private:
-  wrap_data_t wrap_data;
+  mutable std::vector<wrap_line_t> wrap_data;
+  /* The wrap points of the lines that have more than one sub-line. Unused entries are empty, and
+     their indices are listed in free_points. */
+  mutable std::vector<wrap_points_t> extra_points;
+  mutable std::vector<uint32_t> free_points;
   text_buffer_t *text;
   int tabsize;
   int wrap_width;
-  text_pos_t size;
+  mutable text_pos_t size;
+  /* Lines for which the generation differs from this value have not been wrapped using the
+     current settings. Zero is never used as generation. */
+  uint32_t generation;
   connection_t rewrap_connection;
+  /* Fenwick tree of the line counts, using 1-based indices. Element i holds the sum of the line
+     counts of lines [i - (i & -i), i). */
+  mutable std::vector<text_pos_t> line_count_tree;
+  mutable bool line_count_tree_valid;
 
   void delete_lines(text_pos_t first, text_pos_t last);
   void insert_lines(text_pos_t first, text_pos_t last);
   void rewrap_line(text_pos_t line, text_pos_t pos, bool force);
   void rewrap_all();
   void rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b);
+  /* Recompute the wrap points of line, from wrap point index onward. */
+  void wrap_line(text_pos_t line, size_t index) const;
+  void ensure_wrapped(text_pos_t line) const;
+  /* Retrieve the (possibly estimated) line count without wrapping the line. */
+  text_pos_t stored_line_count(text_pos_t line) const;
+  /* Retrieve the start of sub-line index of line. */
+  text_pos_t wrap_point(text_pos_t line, text_pos_t index) const;
+  uint32_t allocate_points(wrap_points_t *points) const;
+  void release_points(wrap_line_t *data) const;
+  void update_line_count(text_pos_t line, text_pos_t change) const;
+  void build_line_count_tree() const;
 
  public:
   wrap_info_t(int width, int tabsize = 8);
@@ -60,10 +110,20 @@ class T3_WIDGET_LOCAL wrap_info_t {
   text_pos_t unwrapped_size() const;
   text_pos_t wrapped_size() const;
   text_pos_t get_line_count(text_pos_t line) const;
+  /** Retrieve the position of a sub-line in the wrapped text, i.e. the number of sub-lines before
+      it. */
+  text_pos_t get_wrapped_pos(text_coordinate_t coord) const;
+  /** Retrieve the sub-line at a position in the wrapped text. Positions beyond the end of the text
+      result in the last sub-line. */
+  text_coordinate_t get_wrapped_coordinate(text_pos_t pos) const;
 
   void set_wrap_width(int width);
   void set_tabsize(int _tabsize);
   void set_text_buffer(text_buffer_t *_text);
+  /** Wrap all lines which have not been wrapped using the current settings.
+      The lines are divided over a number of worker threads, after which all line counts are
+      exact. */
+  void wrap_all();
 
   bool add_lines(text_coordinate_t &coord, text_pos_t count) const;
   bool sub_lines(text_coordinate_t &coord, text_pos_t count) const;
@@ -23,6 +23,7 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "util.h"
 #include "widget_api.h"
@@ -396,7 +397,13 @@ class x11_driver_t {
     return result;
   }
 
-  void claim_selection(bool clipboard, std::unique_ptr<std::string> data) {
+  /** Claim a selection.
+      @param clipboard Boolean indicating whether to claim the clipboard or the primary selection.
+      @param data The data for the selection, or @c nullptr to release the selection.
+      @param lazy Boolean indicating that the primary selection should be claimed without data.
+          The data is requested through request_primary_data when another client needs it.
+  */
+  void claim_selection(bool clipboard, std::unique_ptr<std::string> data, bool lazy = false) {
     timeout_t timeout = timeout_time(1000000);
 
     if (!x11_working()) {
@@ -410,7 +417,7 @@ class x11_driver_t {
 
     std::unique_lock<std::mutex> l(clipboard_mutex);
 
-    const bool has_data = data != nullptr;
+    const bool has_data = data != nullptr || lazy;
     if (clipboard) {
       /* If we don't own the selection, reseting is a no-op. */
       if (clipboard_owner_since == X11_CURRENT_TIME && data == nullptr) {
@@ -421,11 +428,19 @@ class x11_driver_t {
       clipboard_data.reset(data.release());
     } else {
       /* If we don't own the selection, reseting is a no-op. */
-      if (primary_owner_since == X11_CURRENT_TIME && data == nullptr) {
+      if (primary_owner_since == X11_CURRENT_TIME && !has_data) {
+        return;
+      }
+      /* If we already own the selection without data, we don't need to claim it again. */
+      if (lazy && primary_lazy && primary_owner_since != X11_CURRENT_TIME) {
         return;
       }
       action = CLAIM_PRIMARY;
       primary_data.reset(data.release());
+      primary_lazy = lazy;
+      if (!lazy) {
+        answer_deferred_requests();
+      }
     }
 
     if (has_data) {
@@ -444,6 +459,18 @@ class x11_driver_t {
     action = ACTION_NONE;
   }
 
+  /** Provide the data for a primary selection claimed without data.
+      Answers the requests that were waiting for the data. */
+  void provide_primary(std::unique_ptr<std::string> data) {
+    /* NOTE: the clipboard is supposed to be locked when this routine is called. */
+    primary_data.reset(data.release());
+    primary_lazy = false;
+    if (x11_working()) {
+      answer_deferred_requests();
+      x11.x11_flush();
+    }
+  }
+
   void release_selections() {
     timeout_t timeout = timeout_time(1000000);
 
@@ -655,6 +682,54 @@ class x11_driver_t {
     }
   }
 
+  /** Answer a SelectionRequest event from another client. */
+  void answer_request(x11_selection_request_event_t *request_event) {
+    x11_selection_event_t reply;
+    std::shared_ptr<std::string> data;
+    x11_time_t since;
+
+    reply.x11_response_type = X11_SELECTION_NOTIFY;
+    reply.requestor = request_event->requestor;
+    reply.selection = request_event->selection;
+    reply.target = request_event->target;
+    reply.time = request_event->time;
+    if (request_event->target == x11.get_atom(MULTIPLE) &&
+        request_event->property == X11_ATOM_NONE) {
+      reply.property = X11_ATOM_NONE;
+    } else {
+      reply.property = request_event->property == X11_ATOM_NONE ? request_event->target
+                                                                : request_event->property;
+      if (request_event->selection == x11.get_atom(CLIPBOARD) &&
+          clipboard_owner_since != X11_CURRENT_TIME) {
+        data = clipboard_data;
+        since = clipboard_owner_since;
+      } else if (request_event->selection == x11.get_atom(PRIMARY) &&
+                 primary_owner_since != X11_CURRENT_TIME) {
+        data = primary_data;
+        since = primary_owner_since;
+      } else {
+        reply.property = X11_ATOM_NONE;
+      }
+    }
+
+    if (reply.property != X11_ATOM_NONE &&
+        !send_selection(request_event->requestor, request_event->target, reply.property, data,
+                        since)) {
+      reply.property = X11_ATOM_NONE;
+    }
+
+    x11.x11_send_event(request_event->requestor, false, 0,
+                       reinterpret_cast<x11_event_t *>(&reply));
+  }
+
+  /** Answer the requests for the primary selection that were waiting for its data. */
+  void answer_deferred_requests() {
+    for (x11_selection_request_event_t &request_event : deferred_requests) {
+      answer_request(&request_event);
+    }
+    deferred_requests.clear();
+  }
+
   static void process_events_wrapper() { implementation->process_events(); }
 
   /** Thread to process incoming events. */
@@ -747,6 +822,9 @@ class x11_driver_t {
           } else if (clear_event->selection == x11.get_atom(PRIMARY)) {
             primary_owner_since = X11_CURRENT_TIME;
             primary_data = nullptr;
+            primary_lazy = false;
+            /* We no longer own the selection, so this refuses the waiting requests. */
+            answer_deferred_requests();
           }
 
           if ((action == RELEASE_SELECTIONS && clipboard_owner_since == X11_CURRENT_TIME &&
@@ -757,46 +835,18 @@ class x11_driver_t {
           break;
         }
         case X11_SELECTION_REQUEST: {
-          x11_selection_event_t reply;
-          std::shared_ptr<std::string> data;
-          x11_time_t since;
           x11_selection_request_event_t *request_event =
               reinterpret_cast<x11_selection_request_event_t *>(event);
 
-          /* Some other X11 client is requesting our selection. */
-
-          reply.x11_response_type = X11_SELECTION_NOTIFY;
-          reply.requestor = request_event->requestor;
-          reply.selection = request_event->selection;
-          reply.target = request_event->target;
-          reply.time = request_event->time;
-          if (request_event->target == x11.get_atom(MULTIPLE) &&
-              request_event->property == X11_ATOM_NONE) {
-            reply.property = X11_ATOM_NONE;
-          } else {
-            reply.property = request_event->property == X11_ATOM_NONE ? request_event->target
-                                                                      : request_event->property;
-            if (request_event->selection == x11.get_atom(CLIPBOARD) &&
-                clipboard_owner_since != X11_CURRENT_TIME) {
-              data = clipboard_data;
-              since = clipboard_owner_since;
-            } else if (request_event->selection == x11.get_atom(PRIMARY) &&
-                       primary_owner_since != X11_CURRENT_TIME) {
-              data = primary_data;
-              since = primary_owner_since;
-            } else {
-              reply.property = X11_ATOM_NONE;
-            }
-          }
-
-          if (reply.property != X11_ATOM_NONE &&
-              !send_selection(request_event->requestor, request_event->target, reply.property, data,
-                              since)) {
-            reply.property = X11_ATOM_NONE;
+          /* Some other X11 client is requesting our selection. If the data for the primary
+             selection has not been provided yet, the request is answered when it is. */
+          if (request_event->selection == x11.get_atom(PRIMARY) && primary_lazy &&
+              primary_owner_since != X11_CURRENT_TIME) {
+            deferred_requests.push_back(*request_event);
+            request_primary_data();
+            break;
           }
-
-          x11.x11_send_event(request_event->requestor, false, 0,
-                             reinterpret_cast<x11_event_t *>(&reply));
+          answer_request(request_event);
           break;
         }
         default:
@@ -837,6 +887,10 @@ class x11_driver_t {
 
   /* Use X11_CURRENT_TIME as "Invalid" value, as it will never be returned by anything. */
   x11_time_t clipboard_owner_since = X11_CURRENT_TIME, primary_owner_since = X11_CURRENT_TIME;
+  /* Boolean indicating whether the primary selection was claimed without data. */
+  bool primary_lazy = false;
+  /* Requests for the primary selection that are waiting for its data. */
+  std::vector<x11_selection_request_event_t> deferred_requests;
   x11_time_t conversion_started_at = 0;
 
   std::thread x11_event_thread;
@@ -883,6 +937,20 @@ static void claim_selection(bool clipboard, std::unique_ptr<std::string> data) {
   x11_driver_t::implementation->claim_selection(clipboard, std::move(data));
 }
 
+static void claim_primary_lazy() {
+  if (!x11_driver_t::implementation) {
+    return;
+  }
+  x11_driver_t::implementation->claim_selection(false, nullptr, true);
+}
+
+static void provide_primary(std::unique_ptr<std::string> data) {
+  if (!x11_driver_t::implementation) {
+    return;
+  }
+  x11_driver_t::implementation->provide_primary(std::move(data));
+}
+
 static void lock() {
   if (!x11_driver_t::implementation) {
     return;
@@ -914,7 +982,9 @@ T3_WIDGET_API extclipboard_interface_t _t3_widget_extclipboard_calls = {EXTCLIPB
                                                                         claim_selection,
                                                                         lock,
                                                                         unlock,
-                                                                        stop_x11};
+                                                                        stop_x11,
+                                                                        claim_primary_lazy,
+                                                                        provide_primary};
 };
 
 }  // namespace t3widget
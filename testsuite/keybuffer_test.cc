@@ -0,0 +1,141 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stress test for the queues passing keys between threads. The producer pushes many more items
+// than fit in the ring buffers while the consumer alternates between sleeping and emptying the
+// queue, and the consumer checks that all items arrive exactly once and in order.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#define _T3_WIDGET_INTERNAL
+#include "keybuffer.h"
+
+using namespace t3widget;
+
+static bool failed;
+
+static void check(bool condition, const char *what, size_t i) {
+  if (!condition) {
+    std::cout << "Check failed: " << what << " at item " << i << "\n";
+    failed = true;
+  }
+}
+
+static void pause(int max_ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(std::rand() % (max_ms + 1)));
+}
+
+static void test_spsc_queue() {
+  static const size_t count = 200000;
+  spsc_queue_t<size_t, 8> queue;
+
+  std::thread producer([&queue] {
+    for (size_t i = 0; i < count; ++i) {
+      queue.push_back(i);
+      if (i % 20000 == 0) {
+        pause(5);
+      }
+    }
+  });
+
+  size_t items[5];
+  size_t expected = 0;
+  while (expected < count) {
+    size_t fill = queue.pop_front(items, 1 + std::rand() % 5);
+    for (size_t i = 0; i < fill; ++i, ++expected) {
+      check(items[i] == expected, "spsc_queue_t order", expected);
+    }
+    if (fill == 0 || std::rand() % 10000 == 0) {
+      pause(3);
+    }
+  }
+  producer.join();
+  check(!queue.available(), "spsc_queue_t empty", expected);
+}
+
+static void test_item_buffer() {
+  static const size_t count = 50000;
+  item_buffer_t<size_t, 4> buffer;
+
+  std::thread producer([&buffer] {
+    for (size_t i = 0; i < count; ++i) {
+      buffer.push_back(i);
+    }
+  });
+
+  for (size_t i = 0; i < count; ++i) {
+    if (i % 10000 == 0) {
+      pause(20);
+    }
+    check(buffer.pop_front() == i, "item_buffer_t order", i);
+  }
+  producer.join();
+}
+
+static void test_key_buffer() {
+  static const key_t count = 100000;
+  key_buffer_t buffer;
+
+  /* Events posted before keys are retrieved are returned first, and only once. */
+  buffer.push_back('a');
+  buffer.post_event(EKEY_RESIZE);
+  buffer.post_event(EKEY_RESIZE);
+  buffer.push_back_local('b');
+  check(buffer.pop_front() == 'b', "key_buffer_t local key first", 0);
+  check(buffer.pop_front() == EKEY_RESIZE, "key_buffer_t event before keys", 0);
+  check(buffer.pop_front() == 'a', "key_buffer_t single event", 0);
+
+  std::thread producer([&buffer] {
+    for (key_t i = 0; i < count; ++i) {
+      buffer.push_back(i);
+      if (i % 10000 == 0) {
+        buffer.post_event(EKEY_EXTERNAL_UPDATE);
+        pause(5);
+      }
+    }
+  });
+
+  key_t expected = 0;
+  size_t events = 0;
+  while (expected < count) {
+    if (expected % 25000 == 0) {
+      pause(20);
+    }
+    key_t key = buffer.pop_front();
+    if (key == EKEY_EXTERNAL_UPDATE) {
+      ++events;
+      continue;
+    }
+    check(key == expected, "key_buffer_t order", expected);
+    ++expected;
+  }
+  producer.join();
+  /* All events are posted before the last key, and each is returned before later keys. */
+  check(events > 0 && events <= 10, "key_buffer_t events", events);
+
+  key_t key;
+  check(!buffer.pop_front_until(&key, std::chrono::steady_clock::now()), "key_buffer_t empty",
+        expected);
+}
+
+int main(int, char **) {
+  test_spsc_queue();
+  test_item_buffer();
+  test_key_buffer();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Test line_store_t against a plain std::vector of strings. Random insertions and erasures are
+// large enough to split, merge and remove whole chunks, and lines are looked up after each
+// modification, before the chunk start indices have been recalculated. The file loading test
+// writes a file to the current directory, and also checks snapshots of the loaded text.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define _T3_WIDGET_INTERNAL
+#include "linestore.h"
+#include "textline.h"
+
+using namespace t3widget;
+
+static const char file_name[] = "linestore_test.txt";
+
+static bool failed;
+
+static void check(bool condition, const char *what, long value) {
+  if (!condition) {
+    std::cout << "Check failed: " << what << " (" << value << ")\n";
+    failed = true;
+  }
+}
+
+static std::string line_text(int i) { return "line " + std::to_string(i); }
+
+static void check_line(line_store_t &store, const std::vector<std::string> &model,
+                       text_pos_t idx) {
+  check(store[idx]->get_data() == model[idx], "line contents", idx);
+}
+
+static void check_all(line_store_t &store, const std::vector<std::string> &model) {
+  check(store.size() == static_cast<text_pos_t>(model.size()), "size", store.size());
+  if (store.size() != static_cast<text_pos_t>(model.size())) {
+    return;
+  }
+  for (size_t i = 0; i < model.size(); ++i) {
+    check_line(store, model, i);
+  }
+}
+
+static void insert(line_store_t &store, std::vector<std::string> &model, text_pos_t idx,
+                   const std::string &text) {
+  store.insert(idx, default_text_line_factory.new_text_line_t(text));
+  model.insert(model.begin() + idx, text);
+}
+
+static void erase(line_store_t &store, std::vector<std::string> &model, text_pos_t first,
+                  text_pos_t last) {
+  store.erase(first, last);
+  model.erase(model.begin() + first, model.begin() + last);
+}
+
+/* Apply random modifications to store and model, checking a few random lines after each. */
+static void modify_randomly(line_store_t &store, std::vector<std::string> &model, int rounds) {
+  int next_line = model.size();
+  for (int round = 0; round < rounds; ++round) {
+    int operation = std::rand() % 10;
+    if (operation < 6 || model.empty()) {
+      /* Insert a single line, or a block of lines which overflows the chunk it is inserted in. */
+      text_pos_t idx = std::rand() % (model.size() + 1);
+      int count = std::rand() % 2 == 0 ? 1 : 1 + std::rand() % 700;
+      for (int i = 0; i < count; ++i) {
+        insert(store, model, idx + i, line_text(next_line++));
+      }
+    } else {
+      /* Erase a range that may span several chunks. */
+      text_pos_t first = std::rand() % model.size();
+      text_pos_t last = first + std::rand() % std::min<size_t>(model.size() - first + 1, 1500);
+      erase(store, model, first, last);
+    }
+    for (int i = 0; i < 10 && !model.empty(); ++i) {
+      check_line(store, model, std::rand() % model.size());
+    }
+  }
+  check_all(store, model);
+}
+
+static void test_insert_erase() {
+  line_store_t store;
+  std::vector<std::string> model;
+
+  /* Appending fills chunks completely. */
+  for (int i = 0; i < 2000; ++i) {
+    store.push_back(default_text_line_factory.new_text_line_t(line_text(i)));
+    model.push_back(line_text(i));
+  }
+  check_all(store, model);
+
+  /* Look up lines on both sides of a modification before any other look-up. */
+  insert(store, model, 511, "boundary");
+  check_line(store, model, 1999);
+  check_line(store, model, 0);
+  check_line(store, model, 512);
+  erase(store, model, 500, 1100);
+  check_line(store, model, model.size() - 1);
+  check_line(store, model, 500);
+  check_line(store, model, 499);
+
+  modify_randomly(store, model, 300);
+
+  /* Erasing everything must leave a usable store. */
+  erase(store, model, 0, model.size());
+  check_all(store, model);
+  insert(store, model, 0, "first");
+  insert(store, model, 0, "zeroth");
+  check_all(store, model);
+}
+
+static void test_load_file() {
+  std::vector<std::string> model;
+  FILE *file = std::fopen(file_name, "wb");
+  check(file != nullptr, "create file", 0);
+  if (file == nullptr) {
+    return;
+  }
+  for (int i = 0; i < 3000; ++i) {
+    std::string text = line_text(i);
+    /* Include a line with invalid UTF-8, which is changed when the line is loaded. */
+    if (i == 2500) {
+      text += "\xff";
+    }
+    std::fprintf(file, "%s\n", text.c_str());
+    /* Lines loaded from the file must be converted like lines created directly. */
+    model.push_back(default_text_line_factory.new_text_line_t(text)->get_data());
+  }
+  std::fclose(file);
+  /* The last line of the file is the empty line after the final newline. */
+  model.push_back(std::string());
+
+  line_store_t store, unmodified;
+  check(store.load_file(file_name, &default_text_line_factory) == 0, "load file", 0);
+  check(unmodified.load_file(file_name, &default_text_line_factory) == 0, "load file again", 0);
+  std::remove(file_name);
+
+  /* Loading the chunks does not change the hash. */
+  const size_t unloaded_hash = unmodified.hash();
+  check_all(unmodified, model);
+  check(unmodified.hash() == unloaded_hash, "hash after loading", 0);
+
+  /* A snapshot is not affected by later changes, and reads unloaded chunks without converting
+     them. */
+  std::unique_ptr<line_store_t::snapshot_t> snapshot = store.snapshot();
+  const std::vector<std::string> snapshot_model = model;
+
+  /* Modify chunks that have not been loaded yet, and look up lines in others. */
+  check_line(store, model, 1000);
+  insert(store, model, 1700, "inserted");
+  erase(store, model, 200, 900);
+  check_line(store, model, 1200);
+  check_all(store, model);
+
+  /* Snapshots are read from other threads. */
+  std::thread reader([&snapshot, &snapshot_model] {
+    check(snapshot->size() == static_cast<text_pos_t>(snapshot_model.size()), "snapshot size",
+          snapshot->size());
+    std::string line;
+    for (size_t i = 0; i < snapshot_model.size(); ++i) {
+      snapshot->get_line(i, &line);
+      check(line == snapshot_model[i], "snapshot line", i);
+    }
+  });
+  reader.join();
+
+  modify_randomly(store, model, 100);
+}
+
+int main(int, char **) {
+  test_insert_erase();
+  test_load_file();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Test the memory limit and the journal of undo_list_t: records that are merged or spilled to
+// disk must still be undone and redone correctly, and a journal must be restored up to its last
+// complete entry. The journal is written to the current directory.
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "undo.h"
+
+using namespace t3widget;
+
+static const char journal_name[] = "undo_test.journal";
+
+static bool failed;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cout << "Check failed: " << what << "\n";
+    failed = true;
+  }
+}
+
+/* Add a record for each character of text, as if it was typed on line 0. */
+static void type_text(undo_list_t *list, const std::string &text, text_pos_t pos) {
+  for (char c : text) {
+    list->add(UNDO_ADD, text_coordinate_t(0, pos++))->get_text()->append(1, c);
+  }
+}
+
+/* Undo all records, checking that together they add exactly text on line 0.
+   Returns the number of records. */
+static size_t undo_typed_text(undo_list_t *list, const std::string &text) {
+  size_t count = 0;
+  text_pos_t end = text.size();
+  undo_t *undo;
+  while ((undo = list->back()) != nullptr) {
+    std::string undo_text(undo->get_text_view());
+    text_coordinate_t start = undo->get_start();
+    if (undo->get_type() != UNDO_ADD || start.line != 0 ||
+        start.pos + static_cast<text_pos_t>(undo_text.size()) != end ||
+        text.compare(start.pos, undo_text.size(), undo_text) != 0) {
+      check(false, "undo of typed text");
+      return count;
+    }
+    end = start.pos;
+    ++count;
+  }
+  check(end == 0, "undo of all typed text");
+  return count;
+}
+
+/* Redo all records, checking that together they add exactly text on line 0. */
+static size_t redo_typed_text(undo_list_t *list, const std::string &text) {
+  size_t count = 0;
+  text_pos_t start = 0;
+  undo_t *undo;
+  while ((undo = list->forward()) != nullptr) {
+    std::string undo_text(undo->get_text_view());
+    if (undo->get_start().pos != start || text.compare(start, undo_text.size(), undo_text) != 0) {
+      check(false, "redo of typed text");
+      return count;
+    }
+    start += undo_text.size();
+    ++count;
+  }
+  check(static_cast<size_t>(start) == text.size(), "redo of all typed text");
+  return count;
+}
+
+static std::string make_text(size_t size, unsigned seed) {
+  std::string result;
+  for (size_t i = 0; i < size; ++i) {
+    result += static_cast<char>('a' + (i * 7 + seed) % 26);
+  }
+  return result;
+}
+
+static void test_compaction() {
+  undo_list_t list;
+  list.set_memory_limit(16384, false);
+  std::string text = make_text(4000, 0);
+  type_text(&list, text, 0);
+
+  size_t count = undo_typed_text(&list, text);
+  check(count < text.size(), "records merged");
+  check(redo_typed_text(&list, text) == count, "redo after compaction");
+  check(undo_typed_text(&list, text) == count, "undo after redo");
+
+  /* Undo part of the history, and replace it by typing, which compacts the history again. */
+  redo_typed_text(&list, text);
+  for (int i = 0; i < 100; ++i) {
+    list.back();
+  }
+  undo_t *undo = list.back();
+  text_pos_t pos = undo->get_start().pos;
+  std::string new_text = text.substr(0, pos) + make_text(4000, 3);
+  type_text(&list, new_text.substr(pos), pos);
+  check(list.forward() == nullptr, "redo after new records");
+  undo_typed_text(&list, new_text);
+  redo_typed_text(&list, new_text);
+}
+
+static void test_spill() {
+  static const int count = 400;
+  undo_list_t list;
+  list.set_memory_limit(131072, true);
+  /* Records on different lines can not be merged, so the limit can only be met by spilling. The
+     text of the records alone exceeds the limit, the records without their text do not. */
+  for (int i = 0; i < count; ++i) {
+    list.add(UNDO_DELETE, text_coordinate_t(i, 0))->get_text()->append(make_text(400, i));
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    undo_t *undo;
+    int i = count;
+    while ((undo = list.back()) != nullptr) {
+      --i;
+      check(undo->get_start().line == i && undo->get_text_view() == make_text(400, i),
+            "undo of spilled record");
+    }
+    check(i == 0, "undo of all spilled records");
+    while ((undo = list.forward()) != nullptr) {
+      check(undo->get_start().line == i && undo->get_text_view() == make_text(400, i),
+            "redo of spilled record");
+      ++i;
+    }
+    check(i == count, "redo of all spilled records");
+  }
+}
+
+/* Write a journal with three records before the mark for text with hash 1, and two after it.
+   Before the mark, two records are undone and replaced, which truncates the journal. */
+static void write_journal() {
+  std::remove(journal_name);
+  undo_list_t list;
+  check(list.open_journal(journal_name, 0) == 0, "create journal");
+  for (int i = 0; i < 4; ++i) {
+    list.add(UNDO_ADD, text_coordinate_t(i, 0))->get_text()->append("old");
+  }
+  list.back();
+  list.back();
+  list.add(UNDO_DELETE, text_coordinate_t(2, 0))->get_text()->append("new");
+  list.set_mark(1);
+  list.add(UNDO_ADD, text_coordinate_t(3, 0))->get_text()->append("after");
+  list.add(UNDO_ADD, text_coordinate_t(4, 0))->get_text()->append("last");
+}
+
+static void test_journal_truncate() {
+  write_journal();
+
+  {
+    undo_list_t list;
+    check(list.open_journal(journal_name, 1) == 0, "reopen journal");
+    check(list.is_at_mark(), "journal restored at mark");
+    undo_t *undo = list.back();
+    check(undo != nullptr && undo->get_type() == UNDO_DELETE && undo->get_text_view() == "new",
+          "truncated journal replaced record");
+    int count = 0;
+    while ((undo = list.back()) != nullptr) {
+      check(undo->get_text_view() == "old", "truncated journal old record");
+      ++count;
+    }
+    check(count == 2, "truncated journal discarded records");
+    for (int i = 0; i < 3; ++i) {
+      list.forward();
+    }
+    undo = list.forward();
+    check(undo != nullptr && undo->get_text_view() == "after", "journal record after mark");
+    undo = list.forward();
+    check(undo != nullptr && undo->get_text_view() == "last", "journal last record");
+    check(list.forward() == nullptr, "journal end");
+  }
+
+  undo_list_t other;
+  check(other.open_journal(journal_name, 2) == 0, "reopen journal for other text");
+  check(other.back() == nullptr, "journal not restored for other text");
+}
+
+static void test_journal_partial_entry() {
+  write_journal();
+
+  /* Cut the last entry in half, as if the program stopped while writing it. */
+  FILE *file = std::fopen(journal_name, "rb");
+  check(file != nullptr && std::fseek(file, 0, SEEK_END) == 0, "open journal");
+  long size = file == nullptr ? 0 : std::ftell(file);
+  if (file != nullptr) {
+    std::fclose(file);
+  }
+  check(truncate(journal_name, size - 4) == 0, "truncate journal");
+
+  {
+    undo_list_t list;
+    check(list.open_journal(journal_name, 1) == 0, "reopen partial journal");
+    check(list.is_at_mark(), "partial journal restored at mark");
+    undo_t *undo = list.forward();
+    check(undo != nullptr && undo->get_text_view() == "after", "partial journal complete record");
+    check(list.forward() == nullptr, "partial journal incomplete record dropped");
+  }
+
+  /* The journal is rewritten when it is opened, so it must now be complete. */
+  undo_list_t reopened;
+  check(reopened.open_journal(journal_name, 1) == 0, "reopen rewritten journal");
+  check(reopened.is_at_mark() && reopened.back() != nullptr, "rewritten journal restored");
+  std::remove(journal_name);
+}
+
+int main(int, char **) {
+  test_compaction();
+  test_spill();
+  test_journal_truncate();
+  test_journal_partial_entry();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}